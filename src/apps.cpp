@@ -1,140 +1,142 @@
 #include "apps.hpp"
+#include "hyprland.hpp"
 #include "log.hpp"
+#include "process.hpp"
+#include "sway.hpp"
+#include "windows.hpp"
 
-#include <cstdio>
 #include <cstdlib>
-#include <cstring>
-#include <memory>
-#include <sstream>
 #include <string>
 #include <sys/wait.h>
 
-std::string hyprland_get_class_name(const std::string &partial) {
-  std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("hyprctl clients", "r"),
-                                                pclose);
-  if (!pipe) {
-    error("Failed to execute: hyprctl clients");
-    return "";
-  }
+bool app_open(const std::vector<std::string> &argv) {
+  std::string name = argv[0];
+  pid_t pid = spawn_process(argv, [name](int status) {
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+      warning(name + " exited with status " +
+              std::to_string(WEXITSTATUS(status)));
+  });
+  return pid > 0;
+}
 
-  std::string exact_class;
-  char buffer[256];
-  while (fgets(buffer, sizeof(buffer), pipe.get()) != nullptr) {
-    std::string line(buffer);
-    if (line.find("class: ") != std::string::npos) {
-      std::istringstream iss(line);
-      std::string key, value;
-      iss >> key >> value;
-
-      if (value.find(partial) != std::string::npos) {
-        exact_class = value;
-        break;
-      }
-    }
-  }
-  return exact_class;
+bool windows_available(const std::string &app) {
+  if (window_backend() != WINDOWS_NONE)
+    return true;
+
+  warning("Window events are unavailable, can not wait for " + app);
+  return false;
 }
 
-void app_open(const std::string &name, const std::vector<std::string> &args) {
-  pid_t pid = fork();
-  if (pid == -1) {
-    error(std::string("Failed to fork process") + strerror(errno));
-    return;
+bool wait_logged(const std::string &app, const std::string &title,
+                 uint64_t since, uint32_t timeout_ms) {
+  if (wait_for_window(app, title, since, timeout_ms))
+    return true;
+
+  std::string window =
+      "a window of " + app + (title.empty() ? "" : " titled " + title);
+  if (window_backend() == WINDOWS_NONE) {
+    warning("Window events stopped while waiting for " + window);
+  } else {
+    warning("Timed out waiting for " + window);
   }
+  return false;
+}
 
-  if (pid == 0) {
-    std::vector<const char *> c_args = {name.c_str()};
+bool app_open_wait(const std::vector<std::string> &argv,
+                   uint32_t timeout_ms) {
+  std::string app = argv[0].substr(argv[0].rfind('/') + 1);
 
-    for (const auto &arg : args) {
-      c_args.push_back(arg.c_str());
-    }
-    c_args.push_back(nullptr);
+  // Taken before the launch, so a window that shows up right away counts.
+  uint64_t since = window_events();
+  if (!app_open(argv))
+    return false;
 
-    execvp(c_args[0], const_cast<char *const *>(c_args.data()));
+  return windows_available(app) && wait_logged(app, "", since, timeout_ms);
+}
 
-    error("Failed to execute" + name + ": " + strerror(errno));
-    exit(1);
-  } else {
-    int status;
-    waitpid(pid, &status, WNOHANG);
-  }
-  return;
+bool app_wait(const std::string &app, const std::string &title,
+              uint32_t timeout_ms) {
+  if (!windows_available(app))
+    return false;
+
+  uint64_t since = window_events();
+  AppWindow window;
+  if (focused_window(window) && window_matches(window, app, title))
+    return true;
+
+  return wait_logged(app, title, since, timeout_ms);
 }
 
-void app_close(const std::string &name) {
+bool app_close(const std::string &name) {
   const char *wayland_env = getenv("WAYLAND_DISPLAY");
   bool is_wayland = (wayland_env != nullptr);
 
-  pid_t pid = fork();
-  if (pid == -1) {
-    error(std::string("Failed to fork process") + strerror(errno));
-    return;
+  if (is_wayland) {
+    log("Executing: pkill -x '" + name + "'");
+    return run_process({"pkill", "-x", name});
   }
 
-  if (pid == 0) {
-    if (is_wayland) {
-      log("Executing: pkill -x '" + name + "'");
-      execlp("pkill", "pkill", "-x", name.c_str(), nullptr);
-      error(std::string("Failed to execute pkill: ") + strerror(errno));
-    } else {
-      log("Executing: xdotool search --class '" + name + "' windowclose");
-      execlp("xdotool", "xdotool", "search", "--class", name.c_str(),
-             "windowclose", nullptr);
-      error(std::string("Failed to execute xdotool: ") + strerror(errno));
-    }
-    exit(1);
-  } else {
-    int status;
-    waitpid(pid, &status, WNOHANG);
+  log("Executing: xdotool search --class '" + name + "' windowclose");
+  return run_process({"xdotool", "search", "--class", name, "windowclose"});
+}
+
+// Escapes a value for a double quoted sway criteria.
+std::string criteria_value(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
   }
+  return escaped;
 }
 
-void app_switch(const std::string &name) {
+bool app_switch(const std::string &name) {
+  if (window_backend() != WINDOWS_NONE) {
+    AppWindow window;
+    if (!find_window(name, window)) {
+      warning("No matching window found for: " + name);
+      return false;
+    }
+
+    log("Focusing window " + window.id + " (" + window.app + ")");
+    return focus_window(window);
+  }
+
+  // Without a synced registry the compositor is asked directly.
   const char *wayland_env = getenv("WAYLAND_DISPLAY");
   bool is_wayland = (wayland_env != nullptr);
 
-  pid_t pid = fork();
-  if (pid == -1) {
-    error(std::string("Failed to fork process") + strerror(errno));
-    return;
-  }
+  if (is_wayland) {
+    if (!sway_socket().empty()) {
+      std::string command = "[app_id=\"" + criteria_value(name) + "\"] focus";
+      log("Sway command: " + command);
+      if (sway_command(command))
+        return true;
+    }
 
-  if (pid == 0) {
-    if (is_wayland) {
-      const char *sway_env = getenv("SWAYSOCK");
-      if (sway_env) {
-        log("Executing: swaymsg '[app_id=\"" + name + "\"] focus");
-        execlp("swaymsg", "swaymsg", ("[app_id=\"" + name + "\"]").c_str(),
-               "focus", nullptr);
-        error(std::string("Failed to execute swaymsg: ") + strerror(errno));
-      }
+    const char *hypr_env = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+    if (hypr_env) {
+      for (const HyprlandWindow &window : hyprland_clients()) {
+        if (window.class_name.find(name) == std::string::npos)
+          continue;
 
-      const char *hypr_env = getenv("HYPRLAND_INSTANCE_SIGNATURE");
-      if (hypr_env) {
-        std::string full_class = hyprland_get_class_name(name);
-        if (full_class.empty()) {
-          warning("No matching window found for: " + name);
-          return;
-        }
-
-        log("Executing: hyprctl dispatch focuswindow class:" + full_class);
-        execlp("hyprctl", "hyprctl", "dispatch", "focuswindow",
-               ("class:" + full_class).c_str(), nullptr);
-        error(std::string("Failed to execute hyprctl: ") + strerror(errno));
+        log("Focusing Hyprland window " + window.address + " (" +
+            window.class_name + ")");
+        return hyprland_dispatch("focuswindow address:" + window.address);
       }
-    } else {
-      log("Executing: xdotool search --class '" + name + "' windowfocus");
-      execlp("xdotool", "xdotool", "search", "--class", name.c_str(),
-             "windowfocus", nullptr);
-      error(std::string("Failed to execute xdotool: ") + strerror(errno));
-
-      log("(Fallback) Executing: wmctrl -x -a '" + name + "'");
-      execlp("wmctrl", "wmctrl", "-x", "-a", name.c_str(), nullptr);
-      error(std::string("Failed to execute wmctrl: ") + strerror(errno));
+
+      warning("No matching window found for: " + name);
+      return false;
     }
-    exit(1);
-  } else {
-    int status;
-    waitpid(pid, &status, WNOHANG);
+
+    return false;
   }
+
+  log("Executing: xdotool search --class '" + name + "' windowfocus");
+  if (run_process({"xdotool", "search", "--class", name, "windowfocus"}))
+    return true;
+
+  log("(Fallback) Executing: wmctrl -x -a '" + name + "'");
+  return run_process({"wmctrl", "-x", "-a", name});
 }
@@ -1,8 +1,19 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
-void app_open(const std::string &name, const std::vector<std::string> &args);
-void app_close(const std::string &name);
-void app_switch(const std::string &name);
+// Each returns whether the action succeeded. app_open only waits for the
+// launch, the others wait for their helper command to finish.
+bool app_open(const std::vector<std::string> &argv);
+bool app_close(const std::string &name);
+bool app_switch(const std::string &name);
+
+// Launch or wait for a window through the window registry, succeeding once
+// a matching window opens or gains focus within timeout_ms. app_open_wait
+// matches the window against the name of the launched command, app_wait
+// also returns at once if a matching window is already focused.
+bool app_open_wait(const std::vector<std::string> &argv, uint32_t timeout_ms);
+bool app_wait(const std::string &app, const std::string &title,
+              uint32_t timeout_ms);
@@ -0,0 +1,172 @@
+#define CROW_USE_BOOST 1
+
+#include "broadcast.hpp"
+#include "crow.h"
+#include "log.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Each connection is sent at most BROADCAST_BURST messages per tick. Crow
+// buffers every send_text internally and reports neither pending bytes nor
+// write completion, so a slow socket can not be seen from here. The queue
+// bound only catches messages produced faster than the tick drains them, a
+// connection past BROADCAST_QUEUE is closed instead of queueing without
+// limit.
+#define BROADCAST_TICK_MS 20
+#define BROADCAST_BURST 16
+#define BROADCAST_QUEUE 256
+
+struct QueuedMessage {
+  Message message;
+  std::string key;
+};
+
+struct Outbox {
+  crow::websocket::connection *conn;
+  std::deque<QueuedMessage> queue;
+  bool evicted = false;
+};
+
+std::unordered_map<uint64_t, Outbox> outboxes;
+uint64_t next_client = 1;
+std::mutex broadcast_mutex;
+std::condition_variable broadcast_cv;
+std::thread broadcast_thread;
+bool broadcast_stopping = false;
+bool broadcast_queued = false;
+
+Message make_message(std::string text) {
+  return std::make_shared<const std::string>(std::move(text));
+}
+
+// Connections are only touched with broadcast_mutex held, broadcast_remove
+// takes it as well, so a connection is never used after its close handler.
+bool flush_outboxes() {
+  bool backlog = false;
+
+  for (auto &[client, outbox] : outboxes) {
+    crow::websocket::connection *conn = outbox.conn;
+    if (outbox.evicted)
+      continue;
+
+    if (outbox.queue.size() > BROADCAST_QUEUE) {
+      warning("Disconnecting client with a full send queue: " +
+              conn->get_remote_ip());
+      outbox.evicted = true;
+      outbox.queue.clear();
+      conn->close("send queue full", crow::websocket::PolicyViolated);
+      continue;
+    }
+
+    for (int i = 0; i < BROADCAST_BURST && !outbox.queue.empty(); i++) {
+      conn->send_text(*outbox.queue.front().message);
+      outbox.queue.pop_front();
+    }
+
+    if (!outbox.queue.empty())
+      backlog = true;
+  }
+
+  return backlog;
+}
+
+void broadcast_loop() {
+  std::unique_lock<std::mutex> lock(broadcast_mutex);
+  bool backlog = false;
+
+  // With a backlog the next flush waits for the tick, new messages alone do
+  // not let a connection exceed its burst.
+  while (true) {
+    if (backlog) {
+      broadcast_cv.wait_for(lock, std::chrono::milliseconds(BROADCAST_TICK_MS),
+                            [] { return broadcast_stopping; });
+    } else {
+      broadcast_cv.wait(lock,
+                        [] { return broadcast_stopping || broadcast_queued; });
+    }
+
+    if (broadcast_stopping)
+      return;
+
+    broadcast_queued = false;
+    backlog = flush_outboxes();
+  }
+}
+
+void init_broadcast() {
+  std::lock_guard<std::mutex> lock(broadcast_mutex);
+  broadcast_stopping = false;
+  broadcast_queued = false;
+  broadcast_thread = std::thread(broadcast_loop);
+}
+
+void clean_broadcast() {
+  {
+    std::lock_guard<std::mutex> lock(broadcast_mutex);
+    broadcast_stopping = true;
+    outboxes.clear();
+  }
+  broadcast_cv.notify_all();
+
+  if (broadcast_thread.joinable())
+    broadcast_thread.join();
+}
+
+uint64_t broadcast_add(crow::websocket::connection *conn) {
+  std::lock_guard<std::mutex> lock(broadcast_mutex);
+  uint64_t client = next_client++;
+  outboxes[client].conn = conn;
+  return client;
+}
+
+void broadcast_remove(uint64_t client) {
+  std::lock_guard<std::mutex> lock(broadcast_mutex);
+  outboxes.erase(client);
+}
+
+void broadcast(const Message &message, const std::string &key) {
+  {
+    std::lock_guard<std::mutex> lock(broadcast_mutex);
+
+    for (auto &[client, outbox] : outboxes) {
+      if (outbox.evicted)
+        continue;
+
+      bool replaced = false;
+      if (!key.empty()) {
+        for (QueuedMessage &queued : outbox.queue) {
+          if (queued.key == key) {
+            queued.message = message;
+            replaced = true;
+            break;
+          }
+        }
+      }
+
+      if (!replaced)
+        outbox.queue.push_back({message, key});
+    }
+    broadcast_queued = true;
+  }
+  broadcast_cv.notify_one();
+}
+
+void broadcast_to(uint64_t client, const Message &message) {
+  {
+    std::lock_guard<std::mutex> lock(broadcast_mutex);
+
+    auto it = outboxes.find(client);
+    if (it == outboxes.end() || it->second.evicted)
+      return;
+
+    it->second.queue.push_back({message, ""});
+    broadcast_queued = true;
+  }
+  broadcast_cv.notify_one();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace crow {
+namespace websocket {
+struct connection;
+}
+} // namespace crow
+
+// A message encoded once and shared by every connection it is queued to.
+using Message = std::shared_ptr<const std::string>;
+
+Message make_message(std::string text);
+
+void init_broadcast();
+void clean_broadcast();
+
+// Returns the id the connection is known by until broadcast_remove. Ids are
+// never reused, so a message for a closed connection can not reach a new one
+// at the same address.
+uint64_t broadcast_add(crow::websocket::connection *conn);
+void broadcast_remove(uint64_t client);
+
+// Queued messages with the same non-empty key replace each other, so state
+// pushes only ever deliver the latest state to a connection that fell behind.
+void broadcast(const Message &message, const std::string &key = "");
+// Queues a message to one connection, dropped when it is already closed.
+void broadcast_to(uint64_t client, const Message &message);
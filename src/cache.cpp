@@ -0,0 +1,496 @@
+#include "cache.hpp"
+#include "compiler.hpp"
+#include "log.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#define CACHE_MAGIC "MDCACHE"
+#define CACHE_VERSION 6
+
+// File layout, all integers in host byte order:
+//   header:  magic[8] version:u32 event_size:u32 signature:u64 count:u32
+//   entries: name:str size:u64 mtime:i64 hash:u64 payload:str
+// where str is a u32 length followed by the bytes.
+
+struct CacheEntry {
+  SourceStamp stamp;
+  std::string payload;
+  const char *mapped = nullptr;
+  size_t mapped_size = 0;
+};
+
+std::string cache_path;
+uint64_t cache_signature = 0;
+void *cache_map = nullptr;
+size_t cache_map_size = 0;
+
+std::unordered_map<std::string, CacheEntry> cache_entries;
+std::unordered_set<std::string> cache_used;
+bool cache_dirty = false;
+std::mutex cache_mutex;
+
+uint64_t hash_bytes(const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  uint64_t hash = 14695981039346656037ull;
+
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+
+std::string hash_hex(uint64_t hash) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+  return hex;
+}
+
+struct Writer {
+  std::string out;
+
+  template <typename T> void put(const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  void put_bytes(const void *data, size_t size) {
+    put(static_cast<uint32_t>(size));
+    out.append(static_cast<const char *>(data), size);
+  }
+
+  void put_string(const std::string &str) {
+    put_bytes(str.data(), str.size());
+  }
+
+  void put_events(const std::vector<struct input_event> &events) {
+    put_bytes(events.data(), events.size() * sizeof(struct input_event));
+  }
+
+  void put_combo(const KeyCombo &combo) {
+    put_events(combo.press);
+    put_events(combo.release);
+  }
+};
+
+struct Reader {
+  const char *pos;
+  const char *end;
+  bool ok = true;
+
+  template <typename T> T get() {
+    T value{};
+    if (ok && static_cast<size_t>(end - pos) >= sizeof(T)) {
+      memcpy(&value, pos, sizeof(T));
+      pos += sizeof(T);
+    } else {
+      ok = false;
+    }
+    return value;
+  }
+
+  // Element counts are bounded by the remaining bytes so a corrupted file
+  // can not trigger huge allocations.
+  uint32_t get_count() {
+    uint32_t count = get<uint32_t>();
+    if (count > static_cast<size_t>(end - pos))
+      ok = false;
+    return ok ? count : 0;
+  }
+
+  const char *get_bytes(uint32_t &size) {
+    size = get<uint32_t>();
+    if (!ok || static_cast<size_t>(end - pos) < size) {
+      ok = false;
+      return nullptr;
+    }
+    const char *data = pos;
+    pos += size;
+    return data;
+  }
+
+  std::string get_string() {
+    uint32_t size;
+    const char *data = get_bytes(size);
+    return ok ? std::string(data, size) : std::string();
+  }
+
+  void get_events(std::vector<struct input_event> &events) {
+    uint32_t size;
+    const char *data = get_bytes(size);
+    if (!ok || size % sizeof(struct input_event) != 0) {
+      ok = false;
+      return;
+    }
+    events.resize(size / sizeof(struct input_event));
+    memcpy(events.data(), data, size);
+  }
+
+  void get_combo(KeyCombo &combo) {
+    get_events(combo.press);
+    get_events(combo.release);
+  }
+};
+
+std::string serialize_macro(const Macro &macro) {
+  Writer w;
+
+  w.put(static_cast<uint8_t>(macro.has_typing));
+  w.put(static_cast<uint8_t>(macro.typing.burst));
+  w.put(macro.typing.press);
+  w.put(macro.typing.gap);
+
+  w.put(static_cast<uint32_t>(macro.code.size()));
+  for (const Instruction &ins : macro.code) {
+    w.put(static_cast<int32_t>(ins.opcode));
+    w.put(ins.operand);
+  }
+
+  w.put(static_cast<uint32_t>(macro.strings.size()));
+  for (const auto &str : macro.strings) {
+    w.put_string(str);
+  }
+
+  w.put(static_cast<uint32_t>(macro.argvs.size()));
+  for (const auto &argv : macro.argvs) {
+    w.put(static_cast<uint32_t>(argv.size()));
+    for (const auto &arg : argv) {
+      w.put_string(arg);
+    }
+  }
+
+  w.put(static_cast<uint32_t>(macro.combos.size()));
+  for (const auto &combo : macro.combos) {
+    w.put_combo(combo);
+  }
+
+  w.put(static_cast<uint32_t>(macro.texts.size()));
+  for (const auto &text : macro.texts) {
+    w.put(static_cast<uint32_t>(text.size()));
+    for (const auto &combo : text) {
+      w.put_combo(combo);
+    }
+  }
+
+  w.put(static_cast<uint32_t>(macro.ramps.size()));
+  for (const Ramp &ramp : macro.ramps) {
+    w.put(static_cast<int32_t>(ramp.target));
+    w.put(ramp.duration);
+    w.put(static_cast<uint8_t>(ramp.curve));
+  }
+
+  w.put(static_cast<uint32_t>(macro.mixer_args.size()));
+  for (const MixerArg &arg : macro.mixer_args) {
+    w.put(arg.element);
+    w.put(arg.amount);
+  }
+
+  w.put(static_cast<uint32_t>(macro.waits.size()));
+  for (const WindowWait &wait : macro.waits) {
+    w.put(wait.app);
+    w.put(wait.title);
+    w.put(wait.timeout);
+  }
+
+  return w.out;
+}
+
+Macro *deserialize_macro(const char *data, size_t size) {
+  Reader r{data, data + size};
+  std::unique_ptr<Macro> macro(new Macro());
+
+  macro->has_typing = r.get<uint8_t>();
+  macro->typing.burst = r.get<uint8_t>();
+  macro->typing.press = r.get<uint32_t>();
+  macro->typing.gap = r.get<uint32_t>();
+
+  uint32_t count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    Instruction ins;
+    ins.opcode = static_cast<Opcode>(r.get<int32_t>());
+    ins.operand = r.get<int32_t>();
+    macro->code.push_back(ins);
+  }
+
+  count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    macro->strings.push_back(r.get_string());
+  }
+
+  count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    std::vector<std::string> argv(r.get_count());
+    for (auto &arg : argv) {
+      arg = r.get_string();
+    }
+    macro->argvs.push_back(std::move(argv));
+  }
+
+  count = r.get_count();
+  macro->combos.resize(count);
+  for (auto &combo : macro->combos) {
+    r.get_combo(combo);
+  }
+
+  count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    std::vector<KeyCombo> text(r.get_count());
+    for (auto &combo : text) {
+      r.get_combo(combo);
+    }
+    macro->texts.push_back(std::move(text));
+  }
+
+  count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    Ramp ramp;
+    ramp.target = r.get<int32_t>();
+    ramp.duration = r.get<uint32_t>();
+    ramp.curve = static_cast<RampCurve>(r.get<uint8_t>());
+    macro->ramps.push_back(ramp);
+  }
+
+  count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    MixerArg arg;
+    arg.element = r.get<uint32_t>();
+    arg.amount = r.get<int32_t>();
+    macro->mixer_args.push_back(arg);
+  }
+
+  count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    WindowWait wait;
+    wait.app = r.get<int32_t>();
+    wait.title = r.get<int32_t>();
+    wait.timeout = r.get<uint32_t>();
+    macro->waits.push_back(wait);
+  }
+
+  if (!r.ok || r.pos != r.end || !check_macro(*macro))
+    return nullptr;
+
+  return macro.release();
+}
+
+void read_cache_entries(const char *data, size_t size) {
+  Reader r{data, data + size};
+
+  char magic[8];
+  for (char &c : magic) {
+    c = r.get<char>();
+  }
+
+  if (!r.ok || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+      r.get<uint32_t>() != CACHE_VERSION ||
+      r.get<uint32_t>() != sizeof(struct input_event) ||
+      r.get<uint64_t>() != cache_signature) {
+    log("Macro cache is outdated, rebuilding");
+    return;
+  }
+
+  uint32_t count = r.get_count();
+  for (uint32_t i = 0; r.ok && i < count; i++) {
+    std::string name = r.get_string();
+
+    CacheEntry entry;
+    entry.stamp.size = r.get<uint64_t>();
+    entry.stamp.mtime = r.get<int64_t>();
+    entry.stamp.hash = r.get<uint64_t>();
+
+    uint32_t payload_size;
+    entry.mapped = r.get_bytes(payload_size);
+    entry.mapped_size = payload_size;
+
+    if (r.ok)
+      cache_entries[name] = std::move(entry);
+  }
+
+  if (!r.ok) {
+    warning("Macro cache is corrupted, rebuilding");
+    cache_entries.clear();
+  }
+}
+
+bool open_macro_cache(const std::string &path, uint64_t signature) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+
+  cache_path = path;
+  cache_signature = signature;
+  cache_entries.clear();
+  cache_used.clear();
+  cache_dirty = false;
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno != ENOENT)
+      warning("Failed to open macro cache: " + std::string(strerror(errno)));
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    warning("Failed to map macro cache: " + std::string(strerror(errno)));
+    return false;
+  }
+
+  cache_map = map;
+  cache_map_size = st.st_size;
+  read_cache_entries(static_cast<const char *>(map), cache_map_size);
+  return true;
+}
+
+// Only the lookup holds the lock. Entries are decoded outside of it, so the
+// parallel loader does not queue up behind each other on a warm cache; the
+// mapping stays valid until save_macro_cache, after every macro is loaded.
+Macro *cache_find(const std::string &name, const SourceStamp &stamp,
+                  bool match_hash) {
+  const char *data;
+  size_t size;
+  std::string payload;
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    auto it = cache_entries.find(name);
+    if (it == cache_entries.end())
+      return nullptr;
+
+    const CacheEntry &entry = it->second;
+    if (entry.stamp.size != stamp.size)
+      return nullptr;
+
+    if (match_hash) {
+      if (entry.stamp.hash != stamp.hash)
+        return nullptr;
+    } else if (entry.stamp.mtime != stamp.mtime) {
+      return nullptr;
+    }
+
+    if (entry.mapped) {
+      data = entry.mapped;
+      size = entry.mapped_size;
+    } else {
+      // Written by cache_update during this run, copied because it may be
+      // replaced while it is decoded.
+      payload = entry.payload;
+      data = payload.data();
+      size = payload.size();
+    }
+  }
+
+  Macro *macro = deserialize_macro(data, size);
+  if (!macro)
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto it = cache_entries.find(name);
+  if (it != cache_entries.end()) {
+    // Same content under a new mtime, remember it so the next start does
+    // not have to hash the file again.
+    if (it->second.stamp.mtime != stamp.mtime) {
+      it->second.stamp.mtime = stamp.mtime;
+      cache_dirty = true;
+    }
+    cache_used.insert(name);
+  }
+
+  return macro;
+}
+
+void cache_update(const std::string &name, const SourceStamp &stamp,
+                  const Macro &macro) {
+  std::string payload = serialize_macro(macro);
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+
+  CacheEntry &entry = cache_entries[name];
+  entry.stamp = stamp;
+  entry.payload = std::move(payload);
+  entry.mapped = nullptr;
+  entry.mapped_size = 0;
+
+  cache_used.insert(name);
+  cache_dirty = true;
+}
+
+// Pruning drops every entry that was not looked up since the cache was
+// opened, which is only correct after loading all macros of the config.
+void save_macro_cache(bool prune) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+
+  if (!prune) {
+    for (const auto &[name, entry] : cache_entries) {
+      cache_used.insert(name);
+    }
+  }
+
+  if (cache_entries.size() != cache_used.size())
+    cache_dirty = true;
+
+  if (cache_dirty && !cache_path.empty()) {
+    Writer w;
+    w.out.append(CACHE_MAGIC, 8);
+    w.put(static_cast<uint32_t>(CACHE_VERSION));
+    w.put(static_cast<uint32_t>(sizeof(struct input_event)));
+    w.put(cache_signature);
+    w.put(static_cast<uint32_t>(cache_used.size()));
+
+    for (const auto &name : cache_used) {
+      const CacheEntry &entry = cache_entries[name];
+      w.put_string(name);
+      w.put(entry.stamp.size);
+      w.put(entry.stamp.mtime);
+      w.put(entry.stamp.hash);
+      if (entry.mapped) {
+        w.put_bytes(entry.mapped, entry.mapped_size);
+      } else {
+        w.put_string(entry.payload);
+      }
+    }
+
+    // Written next to the old cache and renamed over it, so a crash never
+    // leaves a half written file behind.
+    std::string tmp_path = cache_path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+      warning("Failed to write macro cache: " + std::string(strerror(errno)));
+    } else {
+      bool written = fwrite(w.out.data(), 1, w.out.size(), file) ==
+                     w.out.size();
+      written = (fclose(file) == 0) && written;
+
+      if (!written || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+        warning("Failed to write macro cache");
+        unlink(tmp_path.c_str());
+      }
+    }
+  }
+
+  cache_entries.clear();
+  cache_used.clear();
+  cache_dirty = false;
+
+  if (cache_map) {
+    munmap(cache_map, cache_map_size);
+    cache_map = nullptr;
+    cache_map_size = 0;
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "macro.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Identifies the source file a cached macro was compiled from.
+struct SourceStamp {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;
+};
+
+uint64_t hash_bytes(const void *data, size_t size);
+std::string hash_hex(uint64_t hash);
+
+bool open_macro_cache(const std::string &path, uint64_t signature);
+void save_macro_cache(bool prune);
+
+Macro *cache_find(const std::string &name, const SourceStamp &stamp,
+                  bool match_hash);
+void cache_update(const std::string &name, const SourceStamp &stamp,
+                  const Macro &macro);
@@ -0,0 +1,479 @@
+#include "compiler.hpp"
+#include "cache.hpp"
+#include "log.hpp"
+#include "player.hpp"
+
+#include <memory>
+#include <unordered_map>
+
+#define MAX_PERCENT 100
+// Longest wait, fade or window timeout a macro may ask for, one hour.
+#define MAX_MILLISECONDS 3600000
+#define MAX_TYPING_RATE 100000
+#define MAX_KEY_MS 10000
+
+enum Operands {
+  NO_OPERANDS,
+  INT_OPERAND,
+  STRING_OPERAND,
+  ARGV_OPERANDS,
+  COMBO_OPERAND,
+  TEXT_OPERAND,
+  RAMP_OPERANDS,
+  MIXER_OPERANDS,
+  WAIT_OPERANDS,
+  SOUND_OPERAND,
+};
+
+Operands operands_of(Opcode op) {
+  switch (op) {
+  case APP_OPEN:
+    return ARGV_OPERANDS;
+  case APP_CLOSE:
+  case APP_SWITCH:
+    return STRING_OPERAND;
+  case SOUND_PLAY:
+    return SOUND_OPERAND;
+  case KEY_PRESS:
+  case KEY_RELEASE:
+  case KEY_CLICK:
+    return COMBO_OPERAND;
+  case KEY_TYPE:
+    return TEXT_OPERAND;
+  case VOLUME_RAMP:
+  case CAPTURE_RAMP:
+    return RAMP_OPERANDS;
+  case VOLUME_INC:
+  case VOLUME_DEC:
+  case VOLUME_SET:
+  case CAPTURE_INC:
+  case CAPTURE_DEC:
+  case CAPTURE_SET:
+  case WAIT:
+    return INT_OPERAND;
+  case MIXER_INC:
+  case MIXER_DEC:
+  case MIXER_SET:
+  case MIXER_MUTE:
+  case MIXER_UNMUTE:
+  case MIXER_TOGGLE:
+  case MIXER_RAMP:
+    return MIXER_OPERANDS;
+  case APP_OPEN_WAIT:
+  case WAIT_WINDOW:
+    return WAIT_OPERANDS;
+  default:
+    return NO_OPERANDS;
+  }
+}
+
+// Upper bound of an integer operand, all of them start at 0.
+int64_t operand_limit(Opcode op) {
+  return op == WAIT ? MAX_MILLISECONDS : MAX_PERCENT;
+}
+
+// Reads an integer from 0 to max. Floats such as 5.5 or 1e12 and values out
+// of range are reported instead of being truncated.
+bool compile_int(const json &value, int64_t max, int32_t &out) {
+  bool valid = value.is_number_unsigned()
+                      ? value.get<uint64_t>() <= static_cast<uint64_t>(max)
+                      : value.is_number_integer() &&
+                            value.get<int64_t>() >= 0 &&
+                            value.get<int64_t>() <= max;
+  if (!valid) {
+    error("Expected an integer from 0 to " + std::to_string(max) +
+          ", got " + value.dump());
+    return false;
+  }
+
+  out = static_cast<int32_t>(value.get<int64_t>());
+  return true;
+}
+
+bool in_range(int64_t value, int64_t max) {
+  return value >= 0 && value <= max;
+}
+
+size_t table_size(const Macro &macro, Operands operands) {
+  switch (operands) {
+  case STRING_OPERAND:
+    return macro.strings.size();
+  case ARGV_OPERANDS:
+    return macro.argvs.size();
+  case COMBO_OPERAND:
+    return macro.combos.size();
+  case TEXT_OPERAND:
+    return macro.texts.size();
+  case RAMP_OPERANDS:
+    return macro.ramps.size();
+  case MIXER_OPERANDS:
+    return macro.mixer_args.size();
+  case WAIT_OPERANDS:
+    return macro.waits.size();
+  default:
+    return 0;
+  }
+}
+
+bool check_macro(const Macro &macro) {
+  for (const Instruction &ins : macro.code) {
+    if (ins.opcode <= NOP || ins.opcode > WAIT)
+      return false;
+
+    Operands operands = operands_of(ins.opcode);
+    if (operands == INT_OPERAND &&
+        !in_range(ins.operand, operand_limit(ins.opcode)))
+      return false;
+    if (operands == SOUND_OPERAND &&
+        (ins.operand < 0 || !has_sound(ins.operand)))
+      return false;
+    if (operands == NO_OPERANDS || operands == INT_OPERAND ||
+        operands == SOUND_OPERAND)
+      continue;
+
+    if (ins.operand < 0 ||
+        static_cast<size_t>(ins.operand) >= table_size(macro, operands))
+      return false;
+
+    if (ins.opcode == MIXER_RAMP) {
+      int32_t ramp = macro.mixer_args[ins.operand].amount;
+      if (ramp < 0 || static_cast<size_t>(ramp) >= macro.ramps.size())
+        return false;
+    }
+
+    if (ins.opcode == MIXER_INC || ins.opcode == MIXER_DEC ||
+        ins.opcode == MIXER_SET) {
+      if (!in_range(macro.mixer_args[ins.operand].amount, MAX_PERCENT))
+        return false;
+    }
+
+    if (operands == WAIT_OPERANDS) {
+      const WindowWait &wait = macro.waits[ins.operand];
+      if (wait.timeout > MAX_MILLISECONDS)
+        return false;
+      size_t apps = ins.opcode == APP_OPEN_WAIT ? macro.argvs.size()
+                                                : macro.strings.size();
+      if (wait.app < 0 || static_cast<size_t>(wait.app) >= apps ||
+          wait.title < -1 ||
+          (wait.title >= 0 &&
+           static_cast<size_t>(wait.title) >= macro.strings.size()))
+        return false;
+    }
+  }
+
+  for (const auto &argv : macro.argvs) {
+    if (argv.empty())
+      return false;
+  }
+
+  for (const Ramp &ramp : macro.ramps) {
+    if (ramp.curve < RAMP_LINEAR || ramp.curve > RAMP_EASE ||
+        !in_range(ramp.target, MAX_PERCENT) ||
+        ramp.duration > MAX_MILLISECONDS)
+      return false;
+  }
+
+  size_t elements = mixer_element_count();
+  for (const MixerArg &arg : macro.mixer_args) {
+    if (arg.element >= elements)
+      return false;
+  }
+
+  return true;
+}
+
+uint64_t compile_signature() {
+  const TypingRate &rate = default_typing_rate();
+  uint64_t values[] = {rate.burst, rate.press, rate.gap, mixer_signature(),
+                       sound_signature()};
+  return hash_bytes(values, sizeof(values));
+}
+
+bool compile_curve(const std::string &name, RampCurve &curve) {
+  if (name == "linear") {
+    curve = RAMP_LINEAR;
+  } else if (name == "ease-in") {
+    curve = RAMP_EASE_IN;
+  } else if (name == "ease-out") {
+    curve = RAMP_EASE_OUT;
+  } else if (name == "ease") {
+    curve = RAMP_EASE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Reads target, duration and an optional curve starting at raw_action[first].
+bool compile_ramp(const json &raw_action, size_t first, Ramp &ramp) {
+  size_t argc = raw_action.size() - first;
+  int32_t duration;
+  if (argc < 2 || argc > 3 ||
+      !compile_int(raw_action[first], MAX_PERCENT, ramp.target) ||
+      !compile_int(raw_action[first + 1], MAX_MILLISECONDS, duration))
+    return false;
+
+  ramp.duration = static_cast<uint32_t>(duration);
+  ramp.curve = RAMP_LINEAR;
+  if (argc == 3 &&
+      (!raw_action[first + 2].is_string() ||
+       !compile_curve(raw_action[first + 2].get<std::string>(), ramp.curve)))
+    return false;
+
+  return true;
+}
+
+struct Compiler {
+  Macro *macro;
+  std::unordered_map<std::string, int32_t> interned;
+  std::unordered_map<std::string, int32_t> interned_combos;
+
+  int32_t intern(const std::string &str) {
+    auto it = interned.find(str);
+    if (it != interned.end())
+      return it->second;
+
+    int32_t index = static_cast<int32_t>(macro->strings.size());
+    macro->strings.push_back(str);
+    interned.emplace(str, index);
+    return index;
+  }
+
+  bool intern_combo(const std::string &combination, int32_t &index) {
+    auto it = interned_combos.find(combination);
+    if (it != interned_combos.end()) {
+      index = it->second;
+      return true;
+    }
+
+    KeyCombo combo;
+    if (!compile_combination(combination, combo))
+      return false;
+
+    index = static_cast<int32_t>(macro->combos.size());
+    macro->combos.push_back(std::move(combo));
+    interned_combos.emplace(combination, index);
+    return true;
+  }
+
+  bool compile_action(const json &raw_action, Instruction &ins) {
+    if (!raw_action.is_array() || raw_action.empty() ||
+        !raw_action[0].is_string()) {
+      error("Invalid action format");
+      return false;
+    }
+
+    std::string name = raw_action[0].get<std::string>();
+    ins.opcode = str_to_op(name);
+    ins.operand = 0;
+
+    if (ins.opcode == NOP) {
+      return false;
+    }
+
+    size_t argc = raw_action.size() - 1;
+    switch (operands_of(ins.opcode)) {
+    case NO_OPERANDS:
+      if (argc != 0)
+        break;
+      return true;
+    case INT_OPERAND:
+      if (argc != 1 ||
+          !compile_int(raw_action[1], operand_limit(ins.opcode), ins.operand))
+        break;
+      return true;
+    case STRING_OPERAND:
+      if (argc != 1 || !raw_action[1].is_string())
+        break;
+      ins.operand = intern(raw_action[1].get<std::string>());
+      return true;
+    case SOUND_OPERAND: {
+      if (argc != 1 || !raw_action[1].is_string())
+        break;
+
+      std::string sound = raw_action[1].get<std::string>();
+      ins.operand = sound_id(sound);
+      if (ins.operand < 0) {
+        error("Unknown sound " + sound + " in " + name);
+        return false;
+      }
+      return true;
+    }
+    case ARGV_OPERANDS: {
+      if (argc == 0)
+        break;
+
+      std::vector<std::string> argv;
+      for (size_t i = 1; i < raw_action.size(); i++) {
+        if (!raw_action[i].is_string())
+          break;
+        argv.push_back(raw_action[i].get<std::string>());
+      }
+      if (argv.size() != argc)
+        break;
+
+      ins.operand = static_cast<int32_t>(macro->argvs.size());
+      macro->argvs.push_back(std::move(argv));
+      return true;
+    }
+    case COMBO_OPERAND:
+      if (argc != 1 || !raw_action[1].is_string())
+        break;
+      if (!intern_combo(raw_action[1].get<std::string>(), ins.operand))
+        break;
+      return true;
+    case TEXT_OPERAND: {
+      if (argc != 1 || !raw_action[1].is_string())
+        break;
+
+      std::vector<KeyCombo> text;
+      if (!compile_text(raw_action[1].get<std::string>(), text))
+        break;
+
+      ins.operand = static_cast<int32_t>(macro->texts.size());
+      macro->texts.push_back(std::move(text));
+      return true;
+    }
+    case RAMP_OPERANDS: {
+      Ramp ramp;
+      if (!compile_ramp(raw_action, 1, ramp))
+        break;
+
+      ins.operand = static_cast<int32_t>(macro->ramps.size());
+      macro->ramps.push_back(ramp);
+      return true;
+    }
+    case MIXER_OPERANDS: {
+      if (argc == 0 || !raw_action[1].is_string())
+        break;
+
+      std::string element = raw_action[1].get<std::string>();
+      int id = mixer_element(element);
+      if (id < 0) {
+        error("Unknown mixer element " + element + " in " + name);
+        return false;
+      }
+
+      MixerArg arg{static_cast<uint32_t>(id), 0};
+      if (ins.opcode == MIXER_RAMP) {
+        Ramp ramp;
+        if (!compile_ramp(raw_action, 2, ramp))
+          break;
+        arg.amount = static_cast<int32_t>(macro->ramps.size());
+        macro->ramps.push_back(ramp);
+      } else if (ins.opcode == MIXER_INC || ins.opcode == MIXER_DEC ||
+                 ins.opcode == MIXER_SET) {
+        if (argc != 2 || !compile_int(raw_action[2], MAX_PERCENT, arg.amount))
+          break;
+      } else if (argc != 1) {
+        break;
+      }
+
+      ins.operand = static_cast<int32_t>(macro->mixer_args.size());
+      macro->mixer_args.push_back(arg);
+      return true;
+    }
+    case WAIT_OPERANDS: {
+      // The timeout comes last, after the command or the app and title.
+      int32_t timeout;
+      if (argc < 2 || !compile_int(raw_action[argc], MAX_MILLISECONDS, timeout))
+        break;
+
+      WindowWait wait{0, -1, static_cast<uint32_t>(timeout)};
+      std::vector<std::string> args;
+      for (size_t i = 1; i < argc && raw_action[i].is_string(); i++) {
+        args.push_back(raw_action[i].get<std::string>());
+      }
+      if (args.size() != argc - 1)
+        break;
+
+      if (ins.opcode == APP_OPEN_WAIT) {
+        wait.app = static_cast<int32_t>(macro->argvs.size());
+        macro->argvs.push_back(std::move(args));
+      } else {
+        if (args.size() > 2)
+          break;
+        wait.app = intern(args[0]);
+        if (args.size() == 2)
+          wait.title = intern(args[1]);
+      }
+
+      ins.operand = static_cast<int32_t>(macro->waits.size());
+      macro->waits.push_back(wait);
+      return true;
+    }
+    }
+
+    error("Invalid argument for " + name);
+    return false;
+  }
+};
+
+bool compile_typing(const json &data, TypingRate &rate) {
+  if (!data.is_object())
+    return false;
+
+  rate = default_typing_rate();
+
+  if (data.contains("rate")) {
+    const json &chars = data["rate"];
+    if (chars.is_string() && chars.get<std::string>() == "max") {
+      rate = typing_rate(0);
+    } else {
+      int32_t chars_per_second;
+      if (!compile_int(chars, MAX_TYPING_RATE, chars_per_second) ||
+          chars_per_second == 0)
+        return false;
+      rate = typing_rate(chars_per_second);
+    }
+  }
+
+  int32_t ms;
+  if (data.contains("press")) {
+    if (!compile_int(data["press"], MAX_KEY_MS, ms))
+      return false;
+    rate.press = static_cast<uint32_t>(ms) * 1000;
+  }
+
+  if (data.contains("gap")) {
+    if (!compile_int(data["gap"], MAX_KEY_MS, ms))
+      return false;
+    rate.gap = static_cast<uint32_t>(ms) * 1000;
+  }
+
+  return true;
+}
+
+Macro *compile_macro(const std::string &name, const json &data) {
+  if (!data.is_object() || !data.contains("macro") ||
+      !data["macro"].is_array()) {
+    error("Missing macro actions in: " + name);
+    return nullptr;
+  }
+
+  std::unique_ptr<Macro> macro(new Macro());
+  Compiler compiler{macro.get(), {}, {}};
+
+  if (data.contains("typing")) {
+    if (!compile_typing(data["typing"], macro->typing)) {
+      error("Invalid typing settings in macro: " + name);
+      return nullptr;
+    }
+    macro->has_typing = true;
+  }
+
+  const json &actions = data["macro"];
+  macro->code.reserve(actions.size());
+
+  for (size_t i = 0; i < actions.size(); i++) {
+    Instruction ins;
+    if (!compiler.compile_action(actions[i], ins)) {
+      error("Failed to compile action " + std::to_string(i + 1) +
+            " of macro: " + name);
+      return nullptr;
+    }
+    macro->code.push_back(ins);
+  }
+
+  return macro.release();
+}
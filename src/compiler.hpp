@@ -0,0 +1,15 @@
+#pragma once
+
+#include "macro.hpp"
+#include "nlohmann/json.hpp"
+
+#include <cstdint>
+#include <string>
+
+using json = nlohmann::json;
+
+Macro *compile_macro(const std::string &name, const json &data);
+bool check_macro(const Macro &macro);
+
+// Changes whenever settings that affect compiled macros change.
+uint64_t compile_signature();
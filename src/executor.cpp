@@ -0,0 +1,166 @@
+#include "executor.hpp"
+#include "log.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define MAX_PENDING_RUNS 32
+// How long clean_executor waits for runs in progress before abandoning them.
+#define STOP_TIMEOUT_MS 1000
+
+// Runs of the same macro are serialized through its queue, different macros
+// run in parallel on the worker threads.
+struct Run {
+  std::shared_ptr<const Macro> macro;
+  RunCallback callback;
+};
+
+struct RunQueue {
+  std::deque<Run> pending;
+  bool scheduled = false;
+};
+
+std::unordered_map<std::string, RunQueue> run_queues;
+std::deque<RunQueue *> ready_queues;
+
+std::vector<std::thread> workers;
+std::mutex executor_mutex;
+std::condition_variable executor_cv;
+// Wakes sleeping runs and clean_executor, kept apart from executor_cv so a
+// notify_one for a ready queue is never taken by a sleeping run.
+std::condition_variable stop_cv;
+std::atomic<bool> executor_stopping{false};
+size_t running_workers = 0;
+
+void executor_worker() {
+  std::unique_lock<std::mutex> lock(executor_mutex);
+
+  while (true) {
+    executor_cv.wait(lock, [] {
+      return executor_stopping || !ready_queues.empty();
+    });
+
+    if (executor_stopping)
+      break;
+
+    RunQueue *queue = ready_queues.front();
+    ready_queues.pop_front();
+
+    Run run = std::move(queue->pending.front());
+    queue->pending.pop_front();
+
+    lock.unlock();
+    if (run.callback)
+      run.callback(RUN_STARTED);
+
+    bool ok = run.macro->run();
+
+    if (run.callback)
+      run.callback(ok ? RUN_FINISHED : RUN_FAILED);
+    run = Run();
+    lock.lock();
+
+    if (executor_stopping)
+      break;
+
+    if (queue->pending.empty()) {
+      queue->scheduled = false;
+    } else {
+      ready_queues.push_back(queue);
+      executor_cv.notify_one();
+    }
+  }
+
+  running_workers--;
+  stop_cv.notify_all();
+}
+
+void init_executor(size_t count) {
+  std::lock_guard<std::mutex> lock(executor_mutex);
+  executor_stopping = false;
+
+  if (count < 2)
+    count = 2;
+
+  for (size_t i = 0; i < count; i++) {
+    workers.emplace_back(executor_worker);
+    running_workers++;
+  }
+}
+
+// Pending runs are dropped, runs in progress stop at their next action or
+// wait. A run stuck in a single action is abandoned after STOP_TIMEOUT_MS.
+void clean_executor() {
+  std::unique_lock<std::mutex> lock(executor_mutex);
+  executor_stopping = true;
+  ready_queues.clear();
+  run_queues.clear();
+  executor_cv.notify_all();
+  stop_cv.notify_all();
+
+  bool stopped =
+      stop_cv.wait_for(lock, std::chrono::milliseconds(STOP_TIMEOUT_MS),
+                       [] { return running_workers == 0; });
+  size_t abandoned = running_workers;
+  lock.unlock();
+
+  if (!stopped) {
+    warning("Abandoning " + std::to_string(abandoned) +
+            " macro runs still in progress");
+  }
+
+  for (auto &worker : workers) {
+    if (!worker.joinable())
+      continue;
+    if (stopped)
+      worker.join();
+    else
+      worker.detach();
+  }
+  workers.clear();
+}
+
+bool executor_stopped() {
+  return executor_stopping;
+}
+
+bool executor_sleep(uint32_t ms) {
+  std::unique_lock<std::mutex> lock(executor_mutex);
+  return !stop_cv.wait_for(lock, std::chrono::milliseconds(ms),
+                           [] { return executor_stopping.load(); });
+}
+
+bool executor_submit(const std::string &name,
+                     std::shared_ptr<const Macro> macro,
+                     RunCallback callback) {
+  std::lock_guard<std::mutex> lock(executor_mutex);
+
+  if (executor_stopping || workers.empty()) {
+    error("Macro executor is not running");
+    return false;
+  }
+
+  RunQueue &queue = run_queues[name];
+  if (queue.pending.size() >= MAX_PENDING_RUNS) {
+    warning("Dropping run of macro " + name + ": too many pending runs");
+    return false;
+  }
+
+  if (callback)
+    callback(RUN_ACCEPTED);
+
+  queue.pending.push_back({std::move(macro), std::move(callback)});
+  if (!queue.scheduled) {
+    queue.scheduled = true;
+    ready_queues.push_back(&queue);
+    executor_cv.notify_one();
+  }
+
+  return true;
+}
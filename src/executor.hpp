@@ -0,0 +1,33 @@
+#pragma once
+
+#include "macro.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+enum RunState {
+  RUN_ACCEPTED,
+  RUN_STARTED,
+  RUN_FINISHED,
+  RUN_FAILED,
+};
+
+// Called with RUN_ACCEPTED from executor_submit, with the executor lock held
+// so it comes before the run can start, then from a worker thread as the run
+// progresses.
+using RunCallback = std::function<void(RunState)>;
+
+void init_executor(size_t workers);
+void clean_executor();
+
+bool executor_submit(const std::string &name,
+                     std::shared_ptr<const Macro> macro,
+                     RunCallback callback = nullptr);
+
+// True once clean_executor was called, runs check it between actions.
+bool executor_stopped();
+// Sleeps for ms, returns false if clean_executor cut the sleep short.
+bool executor_sleep(uint32_t ms);
@@ -0,0 +1,98 @@
+#include "hyprland.hpp"
+#include "ipc.hpp"
+#include "log.hpp"
+#include "nlohmann/json.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#define HYPRLAND_TIMEOUT_MS 1000
+
+using json = nlohmann::json;
+
+std::string hyprland_socket(const std::string &name) {
+  const char *signature = getenv("HYPRLAND_INSTANCE_SIGNATURE");
+  if (!signature)
+    return "";
+
+  std::string instance = std::string("/hypr/") + signature + "/";
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir) {
+    std::string path = runtime_dir + instance + name;
+    if (access(path.c_str(), F_OK) == 0)
+      return path;
+  }
+
+  // Hyprland before 0.40 kept its sockets in /tmp.
+  return "/tmp" + instance + name;
+}
+
+// Hyprland answers one request per connection and then closes it.
+bool hyprland_request(const std::string &request, std::string &reply) {
+  std::string path = hyprland_socket(".socket.sock");
+  if (path.empty()) {
+    error("Hyprland is not running");
+    return false;
+  }
+
+  int fd = connect_unix(path, HYPRLAND_TIMEOUT_MS);
+  if (fd < 0) {
+    error("Failed to connect to Hyprland: " + std::string(strerror(errno)));
+    return false;
+  }
+
+  bool ok = write_all(fd, request.data(), request.size()) &&
+            read_to_end(fd, reply);
+  close(fd);
+
+  if (!ok)
+    error("Hyprland request failed: " + request);
+  return ok;
+}
+
+std::vector<HyprlandWindow> hyprland_clients() {
+  std::vector<HyprlandWindow> windows;
+
+  std::string reply;
+  if (!hyprland_request("j/clients", reply))
+    return windows;
+
+  json clients = json::parse(reply, nullptr, false);
+  if (!clients.is_array()) {
+    error("Invalid reply to j/clients from Hyprland");
+    return windows;
+  }
+
+  for (const auto &client : clients) {
+    if (!client.is_object() || !client.contains("address") ||
+        !client["address"].is_string())
+      continue;
+
+    HyprlandWindow window;
+    window.address = client["address"].get<std::string>();
+    if (client.contains("class") && client["class"].is_string())
+      window.class_name = client["class"].get<std::string>();
+    if (client.contains("title") && client["title"].is_string())
+      window.title = client["title"].get<std::string>();
+    if (client.contains("focusHistoryID") &&
+        client["focusHistoryID"].is_number_integer())
+      window.focus_history = client["focusHistoryID"].get<int>();
+    windows.push_back(std::move(window));
+  }
+
+  return windows;
+}
+
+bool hyprland_dispatch(const std::string &dispatch) {
+  std::string reply;
+  if (!hyprland_request("dispatch " + dispatch, reply))
+    return false;
+
+  if (reply != "ok") {
+    warning("Hyprland refused dispatch " + dispatch + ": " + reply);
+    return false;
+  }
+  return true;
+}
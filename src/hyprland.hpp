@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct HyprlandWindow {
+  std::string address;
+  std::string class_name;
+  std::string title;
+  // 0 for the focused window, higher for windows focused longer ago.
+  int focus_history = -1;
+};
+
+// Path of a socket of the running Hyprland instance, empty outside Hyprland.
+std::string hyprland_socket(const std::string &name);
+
+// Sends one request over the Hyprland control socket, the same requests
+// hyprctl sends, e.g. "j/clients".
+bool hyprland_request(const std::string &request, std::string &reply);
+std::vector<HyprlandWindow> hyprland_clients();
+bool hyprland_dispatch(const std::string &dispatch);
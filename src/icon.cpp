@@ -0,0 +1,164 @@
+#include "icon.hpp"
+#include "cache.hpp"
+#include "log.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+std::string icon_dir;
+std::atomic<uint64_t> icon_files{0};
+
+std::string mime_type(const std::string &file) {
+  size_t dot = file.find_last_of('.');
+  std::string extension = dot == std::string::npos ? "" : file.substr(dot + 1);
+
+  if (extension == "png")
+    return "image/png";
+  if (extension == "jpg" || extension == "jpeg")
+    return "image/jpeg";
+  return "application/octet-stream";
+}
+
+uint32_t read_be(const std::string &data, size_t pos, size_t bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | static_cast<unsigned char>(data[pos + i]);
+  }
+  return value;
+}
+
+// Reads the dimensions from the PNG IHDR chunk or the JPEG start of frame
+// marker, leaves them at 0 for anything else.
+void image_size(const std::string &data, int &width, int &height) {
+  width = 0;
+  height = 0;
+
+  if (data.size() >= 24 && data.compare(0, 8, "\x89PNG\r\n\x1a\n") == 0) {
+    width = read_be(data, 16, 4);
+    height = read_be(data, 20, 4);
+    return;
+  }
+
+  if (data.size() < 4 || read_be(data, 0, 2) != 0xFFD8)
+    return;
+
+  size_t pos = 2;
+  while (pos + 9 <= data.size()) {
+    if (static_cast<unsigned char>(data[pos]) != 0xFF)
+      return;
+
+    unsigned char marker = data[pos + 1];
+    if (marker == 0xFF) {
+      pos++;
+      continue;
+    }
+
+    uint32_t length = read_be(data, pos + 2, 2);
+    bool is_frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+                    marker != 0xC8 && marker != 0xCC;
+    if (is_frame) {
+      height = read_be(data, pos + 5, 2);
+      width = read_be(data, pos + 7, 2);
+      return;
+    }
+
+    pos += 2 + length;
+  }
+}
+
+Icon::~Icon() {
+  if (!path.empty())
+    unlink(path.c_str());
+}
+
+// XDG_RUNTIME_DIR and /dev/shm are tmpfs, the icons stay in memory.
+bool init_icons() {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  std::string dir = std::string(runtime_dir ? runtime_dir : "/dev/shm") +
+                    "/macrodeck-icons-XXXXXX";
+  if (!mkdtemp(dir.data())) {
+    error("Failed to create icon directory " + dir + ": " + strerror(errno));
+    return false;
+  }
+
+  icon_dir = dir;
+  return true;
+}
+
+void clean_icons() {
+  if (!icon_dir.empty() && rmdir(icon_dir.c_str()) < 0)
+    warning("Failed to remove " + icon_dir + ": " + strerror(errno));
+}
+
+// Every icon gets a file of its own, the extension tells Crow the type.
+bool write_icon_file(const std::string &file, const std::string &data,
+                     std::string &path) {
+  size_t dot = file.find_last_of('.');
+  path = icon_dir + "/" + std::to_string(icon_files++) +
+         (dot == std::string::npos ? "" : file.substr(dot));
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0400);
+  if (fd < 0)
+    return false;
+
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t length = write(fd, data.data() + written, data.size() - written);
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length <= 0)
+      break;
+    written += length;
+  }
+
+  close(fd);
+  if (written == data.size())
+    return true;
+
+  unlink(path.c_str());
+  return false;
+}
+
+std::shared_ptr<const Icon> load_icon(const std::string &path,
+                                      const std::string &file) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream.is_open()) {
+    error("Failed to load icon: " + path);
+    return nullptr;
+  }
+
+  std::string data((std::istreambuf_iterator<char>(stream)),
+                   std::istreambuf_iterator<char>());
+
+  std::shared_ptr<Icon> icon = std::make_shared<Icon>();
+  icon->file = file;
+  icon->mime = mime_type(file);
+  if (icon_dir.empty() || !write_icon_file(file, data, icon->path)) {
+    error("Failed to keep icon " + path + " in memory: " + strerror(errno));
+    icon->path.clear();
+    return nullptr;
+  }
+  image_size(data, icon->width, icon->height);
+
+  icon->version = hash_hex(hash_bytes(data.data(), data.size()));
+  icon->etag = "\"" + icon->version + "\"";
+
+  return icon;
+}
+
+// If-None-Match may hold a list of tags, possibly marked as weak.
+bool etag_matches(const std::string &header, const std::string &etag) {
+  if (header.empty())
+    return false;
+  if (header == "*")
+    return true;
+
+  return header.find(etag) != std::string::npos;
+}
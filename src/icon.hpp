@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// An icon file kept in memory, served as is by the /icon route. The bytes
+// are written once to a read-only file in a private tmpfs directory, which
+// Crow streams from, instead of being copied into each response body. The
+// file is removed with the icon.
+struct Icon {
+  std::string file;
+  std::string mime;
+  std::string path;
+  std::string version;
+  std::string etag;
+  int width;
+  int height;
+
+  Icon() = default;
+  Icon(const Icon &) = delete;
+  Icon &operator=(const Icon &) = delete;
+  ~Icon();
+};
+
+// Creates the directory served icons are kept in, before any icon is loaded.
+bool init_icons();
+void clean_icons();
+
+std::shared_ptr<const Icon> load_icon(const std::string &path,
+                                      const std::string &file);
+bool etag_matches(const std::string &header, const std::string &etag);
@@ -0,0 +1,84 @@
+#include "ipc.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int connect_unix(const std::string &path, int timeout_ms) {
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  struct timeval timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) <
+      0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  return fd;
+}
+
+bool write_all(int fd, const void *data, size_t size) {
+  const char *ptr = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = send(fd, ptr, size, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    ptr += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool read_exact(int fd, void *data, size_t size) {
+  char *ptr = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t length = read(fd, ptr, size);
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length <= 0)
+      return false;
+    ptr += length;
+    size -= length;
+  }
+  return true;
+}
+
+bool read_to_end(int fd, std::string &data) {
+  char buffer[4096];
+  data.clear();
+  while (true) {
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length < 0)
+      return false;
+    if (length == 0)
+      return true;
+    data.append(buffer, length);
+  }
+}
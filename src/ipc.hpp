@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Blocking helpers for the compositor sockets. Every call gives up after
+// timeout_ms without progress.
+int connect_unix(const std::string &path, int timeout_ms);
+bool write_all(int fd, const void *data, size_t size);
+bool read_exact(int fd, void *data, size_t size);
+// Reads until the peer closes the connection.
+bool read_to_end(int fd, std::string &data);
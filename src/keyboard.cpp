@@ -1,10 +1,13 @@
 #include "keyboard.hpp"
 #include "log.hpp"
+#include "uinput.hpp"
 
+#include <algorithm>
 #include <cctype>
 #include <cstdint>
 #include <cstring>
 #include <fcntl.h>
+#include <filesystem>
 #include <linux/uinput.h>
 #include <sstream>
 #include <string>
@@ -13,7 +16,17 @@
 #include <unordered_map>
 #include <vector>
 
+#define DEVICE_WAIT_MS 2000
+#define DEVICE_POLL_MS 5
+
+#define TYPE_PRESS_US 50000
+#define TYPE_BURST_KEYS 16
+#define TYPE_BURST_GAP_US 2000
+
+namespace fs = std::filesystem;
+
 int keyboard = -1;
+TypingRate default_rate = {false, TYPE_PRESS_US, 0};
 
 Key str_to_keycode(const std::string &key) {
   static const std::unordered_map<std::string, int> key_map = {
@@ -266,13 +279,135 @@ Key char_to_keycode(char c) {
   return {-1, false};
 }
 
-void kb_emit(uint16_t type, uint16_t code, int32_t value) {
+void kb_write(const std::vector<struct input_event> &events) {
+  if (events.empty())
+    return;
+
+  uinput_write(keyboard, events.data(), events.size());
+}
+
+void push_event(std::vector<struct input_event> &events, uint16_t type,
+                uint16_t code, int32_t value) {
   struct input_event ie{};
   ie.type = type;
   ie.code = code;
   ie.value = value;
-  gettimeofday(&ie.time, nullptr);
-  write(keyboard, &ie, sizeof(ie));
+  events.push_back(ie);
+}
+
+void add_key(std::vector<uint16_t> &codes, const Key &key) {
+  auto add = [&codes](uint16_t code) {
+    if (std::find(codes.begin(), codes.end(), code) == codes.end())
+      codes.push_back(code);
+  };
+
+  if (key.shift) {
+    add(KEY_LEFTSHIFT);
+  }
+  add(key.keycode);
+}
+
+// Every key of the combination goes down in one frame and comes back up, in
+// reverse order, in a second frame, so the receiver never sees a partially
+// applied set of modifiers.
+void build_frames(KeyCombo &combo, const std::vector<uint16_t> &codes) {
+  combo.press.clear();
+  combo.release.clear();
+  combo.press.reserve(codes.size() + 1);
+  combo.release.reserve(codes.size() + 1);
+
+  for (auto it = codes.begin(); it != codes.end(); ++it) {
+    push_event(combo.press, EV_KEY, *it, 1);
+  }
+  push_event(combo.press, EV_SYN, SYN_REPORT, 0);
+
+  for (auto it = codes.rbegin(); it != codes.rend(); ++it) {
+    push_event(combo.release, EV_KEY, *it, 0);
+  }
+  push_event(combo.release, EV_SYN, SYN_REPORT, 0);
+}
+
+bool compile_combination(const std::string &combination, KeyCombo &combo) {
+  std::istringstream iss(combination);
+  std::string token;
+  std::vector<uint16_t> codes;
+
+  while (std::getline(iss, token, ' ')) {
+    if (token.empty())
+      continue;
+
+    Key key;
+    if (token.length() == 1) {
+      key = char_to_keycode(token[0]);
+    } else {
+      key = str_to_keycode(token);
+    }
+
+    if (key.keycode < 0) {
+      error("Unknown key: " + token);
+      return false;
+    }
+
+    add_key(codes, key);
+  }
+
+  if (codes.empty()) {
+    error("Invalid key combination: " + combination);
+    return false;
+  }
+
+  build_frames(combo, codes);
+  return true;
+}
+
+bool compile_text(const std::string &text, std::vector<KeyCombo> &keys) {
+  keys.clear();
+  keys.reserve(text.size());
+
+  for (const char &c : text) {
+    Key key = char_to_keycode(c);
+
+    if (key.keycode < 0) {
+      error("Unknown key: " + std::string(1, c));
+      return false;
+    }
+
+    std::vector<uint16_t> codes;
+    add_key(codes, key);
+
+    KeyCombo combo;
+    build_frames(combo, codes);
+    keys.push_back(std::move(combo));
+  }
+
+  return true;
+}
+
+// The keyboard can be used once udev has created its event node, which is
+// usually a matter of milliseconds. Kernels without UI_GET_SYSNAME fall back
+// to a fixed delay.
+bool wait_for_device() {
+  char sysname[64] = {};
+  if (ioctl(keyboard, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+    sleep(1);
+    return true;
+  }
+
+  fs::path sys_path = fs::path("/sys/devices/virtual/input") / sysname;
+
+  for (int waited = 0; waited < DEVICE_WAIT_MS; waited += DEVICE_POLL_MS) {
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(sys_path, ec)) {
+      std::string name = entry.path().filename().string();
+      if (name.rfind("event", 0) == 0 &&
+          fs::exists(fs::path("/dev/input") / name, ec)) {
+        return true;
+      }
+    }
+    usleep(DEVICE_POLL_MS * 1000);
+  }
+
+  return false;
 }
 
 void init_keyboard() {
@@ -310,7 +445,9 @@ void init_keyboard() {
     return;
   }
 
-  sleep(1);
+  if (!wait_for_device()) {
+    warning("Virtual keyboard device node did not appear in time");
+  }
 }
 
 void clean_keyboard() {
@@ -321,116 +458,94 @@ void clean_keyboard() {
   }
 }
 
-void press_key(uint16_t code) {
-  kb_emit(EV_KEY, code, 1);
-  kb_emit(EV_SYN, SYN_REPORT, 0);
-}
+void key_press(const KeyCombo &combo) {
+  if (keyboard < 0) {
+    error("Keyboard is not initialized");
+    return;
+  }
 
-void release_key(uint16_t code) {
-  kb_emit(EV_KEY, code, 0);
-  kb_emit(EV_SYN, SYN_REPORT, 0);
+  kb_write(combo.press);
 }
 
-void key_press(const std::string &combination) {
+void key_release(const KeyCombo &combo) {
   if (keyboard < 0) {
     error("Keyboard is not initialized");
     return;
   }
 
-  std::istringstream iss(combination);
-  std::vector<std::string> tokens;
-  std::string token;
+  kb_write(combo.release);
+}
 
-  while (std::getline(iss, token, ' ')) {
-    tokens.push_back(token);
-  }
+void key_click(const KeyCombo &combo) {
+  key_press(combo);
+  usleep(50000);
+  key_release(combo);
+}
 
-  if (tokens.empty()) {
-    warning("Invalid key combination: " + combination);
-    return;
+TypingRate typing_rate(int chars_per_second) {
+  if (chars_per_second <= 0) {
+    return {true, 0, TYPE_BURST_GAP_US};
   }
 
-  for (size_t i = 0; i < tokens.size(); i++) {
-    Key key;
-    if (tokens[i].length() == 1) {
-      key = char_to_keycode(tokens[i][0]);
-    } else {
-      key = str_to_keycode(tokens[i]);
-    }
+  uint32_t period = 1000000 / static_cast<uint32_t>(chars_per_second);
+  uint32_t press = std::min<uint32_t>(TYPE_PRESS_US, period / 2);
+  return {false, press, period - press};
+}
 
-    if (key.keycode < 0) {
-      error("Unknown key: " + tokens[i]);
-    } else {
-      if (key.shift) {
-        press_key(str_to_keycode("SHIFT").keycode);
-      }
-      press_key(key.keycode);
+void set_default_typing_rate(const TypingRate &rate) {
+  default_rate = rate;
+}
+
+const TypingRate &default_typing_rate() {
+  return default_rate;
+}
+
+// Writes up to TYPE_BURST_KEYS characters with a single writev and only
+// pauses between batches, which keeps the evdev client buffer of the
+// compositor from overflowing.
+void key_type_burst(const std::vector<KeyCombo> &text, const TypingRate &rate) {
+  struct iovec iov[TYPE_BURST_KEYS * 2];
+
+  for (size_t start = 0; start < text.size(); start += TYPE_BURST_KEYS) {
+    size_t end = std::min(text.size(), start + TYPE_BURST_KEYS);
+
+    int count = 0;
+    for (size_t i = start; i < end; i++) {
+      iov[count].iov_base =
+          const_cast<struct input_event *>(text[i].press.data());
+      iov[count].iov_len = text[i].press.size() * sizeof(struct input_event);
+      count++;
+      iov[count].iov_base =
+          const_cast<struct input_event *>(text[i].release.data());
+      iov[count].iov_len = text[i].release.size() * sizeof(struct input_event);
+      count++;
     }
+
+    if (!uinput_writev(keyboard, iov, count))
+      return;
+
+    if (end < text.size() && rate.gap > 0)
+      usleep(rate.gap);
   }
 }
 
-void key_release(const std::string &combination) {
+void key_type(const std::vector<KeyCombo> &text, const TypingRate &rate) {
   if (keyboard < 0) {
     error("Keyboard is not initialized");
     return;
   }
 
-  std::istringstream iss(combination);
-  std::vector<std::string> tokens;
-  std::string token;
-
-  while (std::getline(iss, token, ' ')) {
-    tokens.push_back(token);
-  }
-
-  if (tokens.empty()) {
-    warning("Invalid key combination: " + combination);
+  if (rate.burst) {
+    key_type_burst(text, rate);
     return;
   }
 
-  for (size_t i = 0; i < tokens.size(); i++) {
-    Key key;
-    if (tokens[i].length() == 1) {
-      key = char_to_keycode(tokens[i][0]);
-    } else {
-      key = str_to_keycode(tokens[i]);
-    }
-
-    if (key.keycode < 0) {
-      error("Unknown key: " + tokens[i]);
-    } else {
-      if (key.shift) {
-        release_key(str_to_keycode("SHIFT").keycode);
-      }
-      release_key(key.keycode);
-    }
-  }
-}
-
-void key_click(const std::string &combination) {
-  key_press(combination);
-  usleep(50000);
-  key_release(combination);
-}
-
-void key_type(const std::string &text) {
-  for (const char &c : text) {
-    Key key = char_to_keycode(c);
-
-    if (key.keycode < 0) {
-      error("Unknown key: " + std::string(1, c));
-    } else {
-      if (key.shift) {
-        press_key(str_to_keycode("SHIFT").keycode);
-      }
-      press_key(key.keycode);
-
-      usleep(50000);
-
-      if (key.shift) {
-        release_key(str_to_keycode("SHIFT").keycode);
-      }
-      release_key(key.keycode);
-    }
+  for (const KeyCombo &key : text) {
+    kb_write(key.press);
+    if (rate.press > 0)
+      usleep(rate.press);
+    kb_write(key.release);
+    if (rate.gap > 0)
+      usleep(rate.gap);
   }
 }
@@ -1,16 +1,41 @@
 #pragma once
 
+#include <cstdint>
+#include <linux/input.h>
 #include <string>
+#include <vector>
 
 struct Key {
   int keycode;
   bool shift;
 };
 
+// Key events of a combination, resolved once when the macro is loaded.
+struct KeyCombo {
+  std::vector<struct input_event> press;
+  std::vector<struct input_event> release;
+};
+
+// Timing of key_type in microseconds. Each key is held for `press` and
+// followed by `gap`. In burst mode keys are written in batches and `gap` is
+// the pause between two batches.
+struct TypingRate {
+  bool burst;
+  uint32_t press;
+  uint32_t gap;
+};
+
+TypingRate typing_rate(int chars_per_second);
+void set_default_typing_rate(const TypingRate &rate);
+const TypingRate &default_typing_rate();
+
+bool compile_combination(const std::string &combination, KeyCombo &combo);
+bool compile_text(const std::string &text, std::vector<KeyCombo> &keys);
+
 void init_keyboard();
 void clean_keyboard();
 
-void key_press(const std::string &combination);
-void key_release(const std::string &combination);
-void key_click(const std::string &combination);
-void key_type(const std::string &text);
+void key_press(const KeyCombo &combo);
+void key_release(const KeyCombo &combo);
+void key_click(const KeyCombo &combo);
+void key_type(const std::vector<KeyCombo> &text, const TypingRate &rate);
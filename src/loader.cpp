@@ -1,15 +1,21 @@
 #include "loader.hpp"
+#include "cache.hpp"
+#include "compiler.hpp"
 #include "log.hpp"
-#include "opcode.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <exception>
 #include <filesystem>
 #include <fstream>
 #include <pwd.h>
 #include <stdexcept>
+#include <sys/stat.h>
 #include <string>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
 
 namespace fs = std::filesystem;
 
@@ -27,24 +33,23 @@ std::string get_home_dir() {
   return std::string("/home/") + pw->pw_name;
 }
 
-json load_config(const std::string &path) {
-  fs::path config_path;
-
-  if (path == "-") {
-    std::string home_dir;
-    try {
-      home_dir = get_home_dir();
-    } catch (const std::exception &e) {
-      error(e.what());
-      return nullptr;
-    }
+std::string get_config_path(const std::string &path) {
+  if (path != "-")
+    return path;
 
-    config_path = fs::path(home_dir) / ".config/macrodeck/config.json";
-  } else {
-    config_path = fs::path(path);
+  try {
+    return (fs::path(get_home_dir()) / ".config/macrodeck/config.json")
+        .string();
+  } catch (const std::exception &e) {
+    error(e.what());
+    return "";
   }
+}
 
-  if (!fs::exists(config_path)) {
+json load_config(const std::string &path) {
+  fs::path config_path = get_config_path(path);
+
+  if (config_path.empty() || !fs::exists(config_path)) {
     error("Failed to open config");
     return nullptr;
   }
@@ -66,94 +71,258 @@ json load_config(const std::string &path) {
   return data;
 }
 
-std::array<std::string, 2> get_icon(const std::string &name) {
-  std::string home_dir;
-  try {
-    home_dir = get_home_dir();
-  } catch (const std::exception &e) {
-    error(e.what());
-    return {"", ""};
+void add_macro_names(const json &deck, std::vector<std::string> &names,
+                     std::unordered_set<std::string> &seen) {
+  if (!deck.contains("buttons") || !deck["buttons"].is_array())
+    return;
+
+  for (const auto &button : deck["buttons"]) {
+    if (!button.is_object()) {
+      warning("Invalid button format");
+      continue;
+    }
+
+    if (button.contains("macro") && button["macro"].is_string()) {
+      std::string name = button["macro"].get<std::string>();
+      if (seen.insert(name).second) {
+        names.push_back(name);
+      }
+    }
   }
+}
 
-  fs::path logo_path_png =
-      fs::path(home_dir) / ".config/macrodeck/icons" / (name + ".png");
-  fs::path logo_path_jpg =
-      fs::path(home_dir) / ".config/macrodeck/icons" / (name + ".jpg");
-  fs::path logo_path_jpeg =
-      fs::path(home_dir) / ".config/macrodeck/icons" / (name + ".jpeg");
+std::vector<std::string> get_macro_names(const json &config) {
+  std::vector<std::string> names;
+  std::unordered_set<std::string> seen;
 
-  if (fs::exists(logo_path_png)) {
-    return {logo_path_png.string(), name + ".png"};
-  } else if (fs::exists(logo_path_jpg)) {
-    return {logo_path_jpg.string(), name + ".jpg"};
-  } else if (fs::exists(logo_path_jpeg)) {
-    return {logo_path_jpeg.string(), name + ".jpeg"};
+  if (config.is_array()) {
+    for (const auto &deck : config) {
+      if (deck.is_object())
+        add_macro_names(deck, names, seen);
+    }
+  } else if (config.is_object()) {
+    add_macro_names(config, names, seen);
   }
 
-  return {"", ""};
+  return names;
 }
 
-Macro *load_macro(const std::string &name) {
+void add_mixer_elements(const json &deck, std::vector<MixerElement> &elements) {
+  if (!deck.contains("mixers"))
+    return;
+
+  if (!deck["mixers"].is_object()) {
+    warning("Invalid mixers format");
+    return;
+  }
+
+  for (const auto &[name, data] : deck["mixers"].items()) {
+    if (!data.is_object() || !data.contains("element") ||
+        !data["element"].is_string()) {
+      warning("Invalid mixer element: " + name);
+      continue;
+    }
+
+    MixerElement element{name, "default", data["element"].get<std::string>(),
+                         0, false};
+
+    if (data.contains("card")) {
+      if (!data["card"].is_string()) {
+        warning("Invalid card for mixer element: " + name);
+        continue;
+      }
+      element.card = data["card"].get<std::string>();
+    }
+
+    if (data.contains("index")) {
+      if (!data["index"].is_number_integer() || data["index"].get<int>() < 0) {
+        warning("Invalid index for mixer element: " + name);
+        continue;
+      }
+      element.index = data["index"].get<unsigned>();
+    }
+
+    if (data.contains("capture")) {
+      if (!data["capture"].is_boolean()) {
+        warning("Invalid capture flag for mixer element: " + name);
+        continue;
+      }
+      element.capture = data["capture"].get<bool>();
+    }
+
+    elements.push_back(std::move(element));
+  }
+}
+
+std::vector<MixerElement> get_mixer_elements(const json &config) {
+  std::vector<MixerElement> elements;
+
+  if (config.is_array()) {
+    for (const auto &deck : config) {
+      if (deck.is_object())
+        add_mixer_elements(deck, elements);
+    }
+  } else if (config.is_object()) {
+    add_mixer_elements(config, elements);
+  }
+
+  return elements;
+}
+
+// Icon extensions in order of preference.
+int icon_priority(const std::string &extension) {
+  if (extension == ".png")
+    return 3;
+  if (extension == ".jpg")
+    return 2;
+  if (extension == ".jpeg")
+    return 1;
+  return 0;
+}
+
+ConfigIndex scan_config_dir() {
+  ConfigIndex index;
+
   std::string home_dir;
   try {
     home_dir = get_home_dir();
   } catch (const std::exception &e) {
     error(e.what());
-    return nullptr;
+    return index;
+  }
+
+  fs::path config_dir = fs::path(home_dir) / ".config/macrodeck";
+  std::error_code ec;
+
+  index.dir = config_dir.string();
+  index.cache_path = (config_dir / "macros.cache").string();
+
+  for (const auto &entry :
+       fs::directory_iterator(config_dir / "macros", ec)) {
+    const fs::path &path = entry.path();
+    if (path.extension() == ".json") {
+      index.macros[path.stem().string()] = path.string();
+    }
   }
+  if (ec) {
+    warning("Failed to read macro directory: " + ec.message());
+  }
+
+  std::unordered_map<std::string, int> priorities;
+  for (const auto &entry : fs::directory_iterator(config_dir / "icons", ec)) {
+    const fs::path &path = entry.path();
+    int priority = icon_priority(path.extension().string());
+    if (priority == 0)
+      continue;
+
+    std::string name = path.stem().string();
+    int &best = priorities[name];
+    if (priority > best) {
+      best = priority;
+      index.icons[name] = {path.string(), path.filename().string()};
+    }
+  }
+
+  for (const auto &entry : fs::directory_iterator(config_dir / "sounds", ec)) {
+    const fs::path &path = entry.path();
+    if (path.extension() == ".wav") {
+      index.sounds[path.stem().string()] = path.string();
+    }
+  }
+
+  return index;
+}
 
-  fs::path macro_path =
-      fs::path(home_dir) / ".config/macrodeck/macros/" / (name + ".json");
+std::array<std::string, 2> get_icon(const ConfigIndex &index,
+                                    const std::string &name) {
+  auto it = index.icons.find(name);
+  if (it == index.icons.end())
+    return {"", ""};
+
+  return it->second;
+}
 
-  if (!fs::exists(macro_path)) {
+Macro *load_macro(const std::string &name, const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
     error("Failed to load macro: " + name);
     return nullptr;
   }
 
-  std::ifstream file(macro_path);
+  SourceStamp stamp;
+  stamp.size = st.st_size;
+  stamp.mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+  stamp.hash = 0;
+
+  Macro *macro = cache_find(name, stamp, false);
+  if (macro)
+    return macro;
+
+  std::ifstream file(path, std::ios::binary);
   if (!file.is_open()) {
     error("Failed to load macro: " + name);
     return nullptr;
   }
 
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  stamp.size = content.size();
+  stamp.hash = hash_bytes(content.data(), content.size());
+
+  macro = cache_find(name, stamp, true);
+  if (macro)
+    return macro;
+
   json data;
   try {
-    file >> data;
+    data = json::parse(content);
   } catch (const std::exception &e) {
     error(std::string("Failed to parse json: ") + e.what());
     return nullptr;
   }
 
-  if (data.contains("macro") && data["macro"].is_array()) {
-    Macro *macro = new Macro();
-    for (const auto &raw_action : data["macro"]) {
-      if (!raw_action.is_array() || raw_action.empty() ||
-          !raw_action[0].is_string()) {
-        error("Invalid action format in macro");
-        delete macro;
-        return nullptr;
-      }
+  macro = compile_macro(name, data);
+  if (macro)
+    cache_update(name, stamp, *macro);
 
-      Opcode op = str_to_op(raw_action[0].get<std::string>());
-      Action action(op);
-
-      for (size_t i = 1; i < raw_action.size(); ++i) {
-        if (raw_action[i].is_string()) {
-          action.args.push_back(raw_action[i].get<std::string>());
-        } else if (raw_action[i].is_number_integer()) {
-          action.args.push_back(raw_action[i].get<int>());
-        } else {
-          error("Invalid argument type in action");
-          delete macro;
-          return nullptr;
-        }
-      }
+  return macro;
+}
+
+std::vector<Macro *> load_macros(const ConfigIndex &index,
+                                 const std::vector<std::string> &names,
+                                 bool prune_cache) {
+  std::vector<Macro *> macros(names.size(), nullptr);
+  std::atomic<size_t> next{0};
 
-      macro->macro.push_back(action);
+  if (!index.cache_path.empty())
+    open_macro_cache(index.cache_path, compile_signature());
+
+  auto worker = [&]() {
+    for (size_t i = next++; i < names.size(); i = next++) {
+      auto it = index.macros.find(names[i]);
+      if (it == index.macros.end()) {
+        error("Failed to load macro: " + names[i]);
+        continue;
+      }
+      macros[i] = load_macro(names[i], it->second);
     }
+  };
 
-    return macro;
+  size_t count = std::max(1u, std::thread::hardware_concurrency());
+  count = std::min(count, names.size());
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < count; i++) {
+    workers.emplace_back(worker);
   }
+  worker();
+
+  for (auto &thread : workers) {
+    thread.join();
+  }
+
+  if (!index.cache_path.empty())
+    save_macro_cache(prune_cache);
 
-  return nullptr;
+  return macros;
 }
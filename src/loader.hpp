@@ -3,10 +3,31 @@
 #include "macro.hpp"
 #include "nlohmann/json.hpp"
 
+#include <array>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 using json = nlohmann::json;
 
+// Macro, icon and sound files found in ~/.config/macrodeck, keyed by name.
+struct ConfigIndex {
+  std::string dir;
+  std::string cache_path;
+  std::unordered_map<std::string, std::string> macros;
+  std::unordered_map<std::string, std::array<std::string, 2>> icons;
+  std::unordered_map<std::string, std::string> sounds;
+};
+
+std::string get_config_path(const std::string &path);
 json load_config(const std::string &path);
-Macro *load_macro(const std::string &name);
-std::array<std::string, 2> get_icon(const std::string &name);
+std::vector<std::string> get_macro_names(const json &config);
+std::vector<MixerElement> get_mixer_elements(const json &config);
+ConfigIndex scan_config_dir();
+
+Macro *load_macro(const std::string &name, const std::string &path);
+std::vector<Macro *> load_macros(const ConfigIndex &index,
+                                 const std::vector<std::string> &names,
+                                 bool prune_cache);
+std::array<std::string, 2> get_icon(const ConfigIndex &index,
+                                    const std::string &name);
@@ -4,6 +4,7 @@
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 
 #define RESET "\x1b[0m"
@@ -21,6 +22,8 @@
 #define ERROR "[ERROR  ]"
 #define WARNING "[WARNING]"
 
+std::mutex log_mutex;
+
 std::string current_time() {
   auto now = std::chrono::system_clock::now();
   std::time_t now_c = std::chrono::system_clock::to_time_t(now);
@@ -32,21 +35,25 @@ std::string current_time() {
 }
 
 void log(const std::string &message) {
+  std::lock_guard<std::mutex> lock(log_mutex);
   std::cout << CYAN << "(" << current_time() << ") " << RESET << BOLD << GREEN
             << LOG << RESET << " " << message << std::endl;
 }
 
 void info(const std::string &message) {
+  std::lock_guard<std::mutex> lock(log_mutex);
   std::cout << CYAN << "(" << current_time() << ") " << RESET << BOLD << MAGENTA
             << INFO << RESET << " " << message << std::endl;
 }
 
 void error(const std::string &message) {
+  std::lock_guard<std::mutex> lock(log_mutex);
   std::cerr << CYAN << "(" << current_time() << ") " << RESET << BOLD << RED
             << ERROR << RESET << " " << message << std::endl;
 }
 
 void warning(const std::string &message) {
+  std::lock_guard<std::mutex> lock(log_mutex);
   std::cout << CYAN << "(" << current_time() << ") " << RESET << BOLD << YELLOW
             << WARNING << RESET << " " << message << std::endl;
 }
@@ -0,0 +1,136 @@
+#include "macro.hpp"
+#include "apps.hpp"
+#include "executor.hpp"
+#include "keyboard.hpp"
+#include "log.hpp"
+#include "player.hpp"
+#include "sound.hpp"
+
+// A failed action fails the run, the remaining actions still run. A run
+// cut short by clean_executor fails.
+bool Macro::run() const {
+  bool ok = true;
+
+  for (const Instruction &ins : code) {
+    if (executor_stopped())
+      return false;
+
+    switch (ins.opcode) {
+    case NOP:
+      break;
+    case APP_OPEN:
+      ok = app_open(argvs[ins.operand]) && ok;
+      break;
+    case APP_CLOSE:
+      ok = app_close(strings[ins.operand]) && ok;
+      break;
+    case APP_SWITCH:
+      ok = app_switch(strings[ins.operand]) && ok;
+      break;
+    case APP_OPEN_WAIT: {
+      const WindowWait &wait = waits[ins.operand];
+      ok = app_open_wait(argvs[wait.app], wait.timeout) && ok;
+      break;
+    }
+    case KEY_PRESS:
+      key_press(combos[ins.operand]);
+      break;
+    case KEY_RELEASE:
+      key_release(combos[ins.operand]);
+      break;
+    case KEY_CLICK:
+      key_click(combos[ins.operand]);
+      break;
+    case KEY_TYPE:
+      key_type(texts[ins.operand],
+               has_typing ? typing : default_typing_rate());
+      break;
+    case VOLUME_INC:
+      volume_inc(ins.operand);
+      break;
+    case VOLUME_DEC:
+      volume_dec(ins.operand);
+      break;
+    case VOLUME_SET:
+      volume_set(ins.operand);
+      break;
+    case VOLUME_MUTE:
+      volume_mute();
+      break;
+    case VOLUME_UNMUTE:
+      volume_unmute();
+      break;
+    case VOLUME_TOGGLE:
+      volume_toggle();
+      break;
+    case VOLUME_RAMP:
+      volume_ramp(ramps[ins.operand]);
+      break;
+    case CAPTURE_INC:
+      capture_inc(ins.operand);
+      break;
+    case CAPTURE_DEC:
+      capture_dec(ins.operand);
+      break;
+    case CAPTURE_SET:
+      capture_set(ins.operand);
+      break;
+    case CAPTURE_MUTE:
+      capture_mute();
+      break;
+    case CAPTURE_UNMUTE:
+      capture_unmute();
+      break;
+    case CAPTURE_TOGGLE:
+      capture_toggle();
+      break;
+    case CAPTURE_RAMP:
+      capture_ramp(ramps[ins.operand]);
+      break;
+    case MIXER_INC:
+      mixer_inc(mixer_args[ins.operand].element,
+                mixer_args[ins.operand].amount);
+      break;
+    case MIXER_DEC:
+      mixer_dec(mixer_args[ins.operand].element,
+                mixer_args[ins.operand].amount);
+      break;
+    case MIXER_SET:
+      mixer_set(mixer_args[ins.operand].element,
+                mixer_args[ins.operand].amount);
+      break;
+    case MIXER_MUTE:
+      mixer_mute(mixer_args[ins.operand].element);
+      break;
+    case MIXER_UNMUTE:
+      mixer_unmute(mixer_args[ins.operand].element);
+      break;
+    case MIXER_TOGGLE:
+      mixer_toggle(mixer_args[ins.operand].element);
+      break;
+    case MIXER_RAMP:
+      mixer_ramp(mixer_args[ins.operand].element,
+                 ramps[mixer_args[ins.operand].amount]);
+      break;
+    case SOUND_PLAY:
+      sound_play(ins.operand);
+      break;
+    case WAIT_WINDOW: {
+      const WindowWait &wait = waits[ins.operand];
+      ok = app_wait(strings[wait.app],
+                    wait.title < 0 ? "" : strings[wait.title], wait.timeout) &&
+           ok;
+      break;
+    }
+    case WAIT:
+      if (!executor_sleep(ins.operand))
+        return false;
+      break;
+    default:
+      error("Invalid opcode " + std::to_string(ins.opcode));
+      return false;
+    }
+  }
+
+  return ok;
+}
@@ -1,15 +1,47 @@
 #pragma once
 
-#include "action.hpp"
+#include "keyboard.hpp"
+#include "opcode.hpp"
+#include "sound.hpp"
 
+#include <cstdint>
+#include <string>
 #include <vector>
 
+// A single compiled action. Integer arguments are stored inline in the
+// operand, string arguments as an index into one of the macro tables.
+struct Instruction {
+  Opcode opcode;
+  int32_t operand;
+};
+
+// A mixer element resolved to its id at compile time. For mixer_ramp the
+// amount is an index into the ramps table.
+struct MixerArg {
+  uint32_t element;
+  int32_t amount;
+};
+
+// A window to wait for. For app_open_wait app is an index into argvs, for
+// wait_window into strings, like title, which is -1 to match any title.
+struct WindowWait {
+  int32_t app;
+  int32_t title;
+  uint32_t timeout;
+};
+
 struct Macro {
-  std::vector<Action> macro;
+  std::vector<Instruction> code;
+  std::vector<std::string> strings;
+  std::vector<std::vector<std::string>> argvs;
+  std::vector<KeyCombo> combos;
+  std::vector<std::vector<KeyCombo>> texts;
+  std::vector<Ramp> ramps;
+  std::vector<MixerArg> mixer_args;
+  std::vector<WindowWait> waits;
+
+  bool has_typing = false;
+  TypingRate typing{};
 
-  void run() const {
-    for (const auto &action : macro) {
-      action.execute();
-    }
-  }
+  bool run() const;
 };
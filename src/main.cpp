@@ -1,19 +1,33 @@
 #define CROW_USE_BOOST 1
 
 #include "argparse.hpp"
+#include "broadcast.hpp"
 #include "crow.h"
+#include "executor.hpp"
 #include "keyboard.hpp"
 #include "loader.hpp"
 #include "log.hpp"
 #include "macro.hpp"
+#include "metrics.hpp"
 #include "nlohmann/json.hpp"
+#include "player.hpp"
+#include "process.hpp"
+#include "protocol.hpp"
+#include "snapshot.hpp"
 #include "sound.hpp"
+#include "sway.hpp"
+#include "watcher.hpp"
+#include "windows.hpp"
 
 #include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <ifaddrs.h>
 #include <ios>
 #include <iostream>
@@ -21,9 +35,12 @@
 #include <netinet/in.h>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <sys/types.h>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #define VERSION "0.0.4"
 #define TAG "-dev"
@@ -31,39 +48,274 @@
 using json = nlohmann::json;
 namespace fs = std::filesystem;
 
-std::unordered_map<std::string, Macro *> loaded_macros;
-std::vector<std::array<std::string, 2>> icons;
-
 std::unordered_map<crow::websocket::connection *, bool> authenticated_devices;
 std::unordered_set<crow::websocket::connection *> elevated;
+// Broadcast ids of authenticated connections, see broadcast_add.
+std::unordered_map<crow::websocket::connection *, uint64_t> client_ids;
 std::mutex auth_mutex;
+std::atomic<bool> ready{false};
+// Mixer elements are only registered at startup.
+std::vector<MixerElement> configured_mixers;
 
 std::string get_base_dir() {
   std::string exe_dir = fs::canonical("/proc/self/exe").parent_path().string();
   return fs::path(exe_dir).parent_path().string();
 }
 
-void setup() {
-  log("Initializing master volume control");
-  log("Initializing master capture control");
-  init_alsa();
-  log("Initializing virtual keyboard");
-  init_keyboard();
+// Devices are initialized in the background so the server can start
+// accepting connections while they warm up.
+std::vector<std::future<void>> setup(const std::string &sound_device) {
+  log("Initializing macro executor");
+  init_executor(std::thread::hardware_concurrency());
+  init_broadcast();
+  log("Starting window registry");
+  init_windows();
+
+  std::vector<std::future<void>> tasks;
+  tasks.push_back(std::async(std::launch::async, [] {
+    log("Initializing master volume control");
+    log("Initializing master capture control");
+    init_alsa();
+  }));
+  tasks.push_back(std::async(std::launch::async, [sound_device] {
+    log("Initializing sound output");
+    init_player(sound_device);
+  }));
+  tasks.push_back(std::async(std::launch::async, [] {
+    log("Initializing virtual keyboard");
+    init_keyboard();
+  }));
+  return tasks;
+}
+
+// Reload notices are keyed by their text, repeated notices for the same file
+// collapse into one for clients that have not received the first yet.
+void notify_clients(const std::string &message) {
+  broadcast(make_message(message), message);
+}
+
+// Mixer changes are pushed as one short message per changed field, keyed by
+// the field so clients that fell behind only get its current value. Without
+// a previous state every field is included.
+std::vector<std::string> mixer_messages(const MixerState &state,
+                                        const MixerState *previous) {
+  std::vector<std::string> messages;
+  if (!previous || state.volume != previous->volume)
+    messages.push_back("mixer:volume:" + std::to_string(state.volume));
+  if (!previous || state.muted != previous->muted)
+    messages.push_back(std::string("mixer:mute:") + (state.muted ? "1" : "0"));
+  if (!previous || state.capture != previous->capture)
+    messages.push_back("mixer:capture:" + std::to_string(state.capture));
+  if (!previous || state.capture_muted != previous->capture_muted)
+    messages.push_back(std::string("mixer:capture-mute:") +
+                       (state.capture_muted ? "1" : "0"));
+  return messages;
+}
+
+void push_mixer_state(const MixerState &state, const MixerState &previous) {
+  for (std::string &message : mixer_messages(state, &previous)) {
+    std::string key = message.substr(0, message.find_last_of(':'));
+    broadcast(make_message(std::move(message)), key);
+  }
+}
+
+// Called with auth_mutex held, right after a client is authenticated.
+void welcome(crow::websocket::connection &conn) {
+  client_ids[&conn] = broadcast_add(&conn);
+  for (const std::string &message : mixer_messages(mixer_state(), nullptr)) {
+    conn.send_text(message);
+  }
+}
+
+std::string run_event(uint64_t request, const char *state,
+                      const char *reason = nullptr) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  json event = {
+      {"request", request},
+      {"state", state},
+      {"time", std::chrono::duration_cast<std::chrono::microseconds>(now)
+                   .count()},
+  };
+  if (reason) {
+    event["error"] = reason;
+  }
+  return "event:" + event.dump();
+}
+
+// Run events go through the connection's outbox, keyed by its broadcast id,
+// so executor threads never take auth_mutex and an event for a closed
+// connection is dropped instead of reaching whichever connection took its
+// place.
+void send_run_event(uint64_t client, uint64_t request, RunState state) {
+  static const char *names[] = {"accepted", "started", "finished", "failed"};
+  broadcast_to(client, make_message(run_event(request, names[state])));
+}
+
+// Returns the reason the command failed or nullptr. Macros are only queued
+// here, their progress is reported through the run callback.
+const char *queue_macro(crow::websocket::connection &conn,
+                        const Command &command, const std::string &name,
+                        std::shared_ptr<const Macro> macro) {
+  RunCallback callback;
+  if (command.has_request) {
+    uint64_t client = client_ids[&conn];
+    uint64_t request = command.request;
+    callback = [client, request](RunState state) {
+      send_run_event(client, request, state);
+    };
+  }
+
+  info("Queueing macro: " + name);
+  if (!executor_submit(name, std::move(macro), std::move(callback)))
+    return "queue full";
+  return nullptr;
+}
+
+// Called with auth_mutex held, for a command that could not be decoded.
+void reject_command(crow::websocket::connection &conn,
+                    const Command &command) {
+  if (command.has_request) {
+    conn.send_text(run_event(command.request, "failed", "invalid command"));
+  }
+}
+
+// Called with auth_mutex held.
+void run_command(crow::websocket::connection &conn, const Command &command) {
+  bool is_elevated = elevated.find(&conn) != elevated.end();
+  const char *failure = nullptr;
+  std::shared_ptr<const Snapshot> snapshot;
+
+  switch (command.op) {
+  case CMD_RUN_MACRO:
+    snapshot = current_snapshot();
+    if (command.macro < snapshot->macro_table.size() &&
+        snapshot->macro_table[command.macro].macro) {
+      const MacroSlot &slot = snapshot->macro_table[command.macro];
+      if (!(failure = queue_macro(conn, command, slot.name, slot.macro)))
+        return;
+    } else {
+      error("Invalid macro id: " + std::to_string(command.macro));
+      failure = "invalid macro";
+    }
+    break;
+  case CMD_RUN_MACRO_NAME: {
+    snapshot = current_snapshot();
+    std::string name(command.name);
+    auto it = snapshot->macros.find(name);
+    if (it != snapshot->macros.end()) {
+      if (!(failure = queue_macro(conn, command, name, it->second)))
+        return;
+    } else {
+      error("Invalid macro: " + name);
+      failure = "invalid macro";
+    }
+    break;
+  }
+  case CMD_INC_VOLUME:
+  case CMD_DEC_VOLUME:
+  case CMD_TOG_VOLUME:
+  case CMD_INC_CAPTURE:
+  case CMD_DEC_CAPTURE:
+  case CMD_TOG_CAPTURE:
+    if (!is_elevated) {
+      failure = "not permitted";
+      break;
+    }
+    if (command.has_request) {
+      conn.send_text(run_event(command.request, "accepted"));
+      conn.send_text(run_event(command.request, "started"));
+    }
+
+    if (command.op == CMD_INC_VOLUME) {
+      log("running inc-volume");
+      volume_inc(5);
+    } else if (command.op == CMD_DEC_VOLUME) {
+      log("running dec-volume");
+      volume_dec(5);
+    } else if (command.op == CMD_TOG_VOLUME) {
+      log("running tog-volume");
+      volume_toggle();
+    } else if (command.op == CMD_INC_CAPTURE) {
+      log("running inc-capture");
+      capture_inc(5);
+    } else if (command.op == CMD_DEC_CAPTURE) {
+      log("running dec-capture");
+      capture_dec(5);
+    } else {
+      log("running tog-capture");
+      capture_toggle();
+    }
+    break;
+  default:
+    failure = "invalid command";
+    break;
+  }
+
+  if (command.has_request) {
+    conn.send_text(run_event(command.request, failure ? "failed" : "finished",
+                             failure));
+  }
+}
+
+void reload(const std::string &config_path, const ChangeSet &changes) {
+  std::shared_ptr<const Snapshot> previous = current_snapshot();
+  std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>();
+
+  next->config = previous->config;
+  if (changes.config) {
+    log("Reloading config");
+    json config = load_config(config_path);
+    if (config == nullptr) {
+      warning("Keeping previous config");
+    } else {
+      if (get_mixer_elements(config) != configured_mixers)
+        warning("Mixer elements changed, restart MacroDeck to apply them");
+      next->config = std::move(config);
+    }
+  }
+
+  next->index = scan_config_dir();
+  load_icons(*next, previous.get(), changes.icons);
+  load_sounds(*next, previous.get(), changes.sounds);
+  build_client_config(*next);
+  load_macros(*next, previous.get(), changes.macros);
+  publish_snapshot(next);
+
+  if (changes.config) {
+    notify_clients("reload:config");
+  }
+  for (const auto &name : changes.macros) {
+    notify_clients("reload:macro:" + name);
+  }
+  for (const auto &name : changes.icons) {
+    notify_clients("reload:icon:" + name);
+  }
 }
 
 void cleanup() {
   std::cout << "\n";
-  log("Cleaning master volume control");
-  log("Cleaning master capture control");
+  // First, so runs waiting for a window are released right away.
+  log("Stopping window registry");
+  clean_windows();
+  log("Stopping macro executor");
+  clean_executor();
+  log("Stopping process reaper");
+  clean_processes();
+  log("Stopping broadcasts");
+  clean_broadcast();
+  log("Closing mixers");
   clean_alsa();
+  log("Closing sound output");
+  clean_player();
   log("Cleaning virtual keyboard");
   clean_keyboard();
+  log("Stopping config watcher");
+  clean_watcher();
+  log("Closing sway connection");
+  clean_sway();
 
-  for (auto &[name, macro] : loaded_macros) {
-    log("Deallocating macro: " + name);
-    delete macro;
-  }
-  loaded_macros.clear();
+  publish_snapshot(std::make_shared<Snapshot>());
+  clean_icons();
 }
 
 void sig_handler(int signal) {
@@ -118,6 +370,21 @@ int main(int argc, char **argv) {
       .default_value(std::string(""))
       .metavar("<password>");
 
+  program.add_argument("--typing-rate")
+      .help("set the default key_type speed in characters per second or 'max'")
+      .default_value(std::string(""))
+      .metavar("<rate>");
+
+  program.add_argument("--mixer-tick")
+      .help("apply volume and capture commands at most once per <ms>")
+      .default_value(std::string(""))
+      .metavar("<ms>");
+
+  program.add_argument("--sound-device")
+      .help("play sounds on the ALSA PCM <device>")
+      .default_value(std::string("default"))
+      .metavar("<device>");
+
   program.add_argument("-V", "--verbose")
       .help("increase output verbosity")
       .flag();
@@ -204,9 +471,27 @@ int main(int argc, char **argv) {
     info("User authentication enabled");
   }
 
-  setup();
-  std::atexit(cleanup);
-  std::signal(SIGINT, sig_handler);
+  std::string typing = program.get("--typing-rate");
+  if (typing == "max") {
+    set_default_typing_rate(typing_rate(0));
+  } else if (!typing.empty()) {
+    int chars_per_second = std::atoi(typing.c_str());
+    if (chars_per_second <= 0) {
+      error("Invalid typing rate: " + typing);
+      return 1;
+    }
+    set_default_typing_rate(typing_rate(chars_per_second));
+  }
+
+  std::string mixer_tick = program.get("--mixer-tick");
+  if (!mixer_tick.empty()) {
+    int milliseconds = std::atoi(mixer_tick.c_str());
+    if (milliseconds <= 0 && mixer_tick != "0") {
+      error("Invalid mixer tick: " + mixer_tick);
+      return 1;
+    }
+    set_mixer_tick(milliseconds);
+  }
 
   log("Getting config");
   json config = load_config(confing_path);
@@ -216,69 +501,35 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  if (config.is_array()) {
-    for (const auto &conf : config) {
-      if (conf.contains("buttons") && conf["buttons"].is_array()) {
-        for (const auto &button : conf["buttons"]) {
-          if (!button.is_object()) {
-            warning("Invalid button format");
-            continue;
-          }
-
-          if (button.contains("macro") && button["macro"].is_string()) {
-            std::string macro_name = button["macro"].get<std::string>();
-            if (loaded_macros.find(macro_name) != loaded_macros.end()) {
-              continue;
-            }
-
-            Macro *macro = load_macro(macro_name);
-
-            if (macro) {
-              log("Loaded macro: " + macro_name);
-              loaded_macros[macro_name] = macro;
+  // Macros refer to mixer elements by id, so they are registered before
+  // ALSA is opened and before anything is compiled.
+  configured_mixers = get_mixer_elements(config);
+  configure_mixers(configured_mixers);
 
-              std::array<std::string, 2> icon = get_icon(macro_name);
-              if (icon[0] != "" && icon[1] != "") {
-                icons.push_back(icon);
-              }
-            } else {
-              warning("Failed to load macro: " + macro_name);
-            }
-          }
-        }
-      }
-    }
-  } else if (config.is_object()) {
-    if (config.contains("buttons") && config["buttons"].is_array()) {
-      for (const auto &button : config["buttons"]) {
-        if (!button.is_object()) {
-          warning("Invalid button format");
-          continue;
-        }
+  // Before any thread is started, see init_processes.
+  log("Starting process reaper");
+  init_processes();
 
-        if (button.contains("macro") && button["macro"].is_string()) {
-          std::string macro_name = button["macro"].get<std::string>();
-          if (loaded_macros.find(macro_name) != loaded_macros.end()) {
-            continue;
-          }
-
-          Macro *macro = load_macro(macro_name);
+  set_mixer_listener(push_mixer_state);
+  std::vector<std::future<void>> startup =
+      setup(program.get("--sound-device"));
+  std::atexit(cleanup);
+  std::signal(SIGINT, sig_handler);
 
-          if (macro) {
-            log("Loaded macro: " + macro_name);
-            loaded_macros[macro_name] = macro;
-
-            std::array<std::string, 2> icon = get_icon(macro_name);
-            if (icon[0] != "" && icon[1] != "") {
-              icons.push_back(icon);
-            }
-          } else {
-            warning("Failed to load macro: " + macro_name);
-          }
-        }
-      }
-    }
-  }
+  init_icons();
+  std::shared_ptr<Snapshot> initial = std::make_shared<Snapshot>();
+  initial->config = std::move(config);
+  initial->index = scan_config_dir();
+  load_icons(*initial, nullptr, {});
+  build_client_config(*initial);
+  publish_snapshot(initial);
+
+  startup.push_back(std::async(std::launch::async, [initial] {
+    std::shared_ptr<Snapshot> loaded = std::make_shared<Snapshot>(*initial);
+    load_sounds(*loaded, nullptr, {});
+    load_macros(*loaded, nullptr, {});
+    publish_snapshot(loaded);
+  }));
 
   std::string base_dir = get_base_dir();
   std::string template_dir = base_dir + "/templates";
@@ -315,6 +566,7 @@ int main(int argc, char **argv) {
 
           authenticated_devices[&conn] = true;
           conn.send_text("auth-not-required");
+          welcome(conn);
           accept = false;
         } else {
           authenticated_devices[&conn] = false;
@@ -327,6 +579,11 @@ int main(int argc, char **argv) {
                    uint16_t) {
         std::lock_guard<std::mutex> lock(auth_mutex);
         authenticated_devices.erase(&conn);
+        auto client = client_ids.find(&conn);
+        if (client != client_ids.end()) {
+          broadcast_remove(client->second);
+          client_ids.erase(client);
+        }
         log("Closed connection with: " + conn.get_remote_ip() +
             " with reason: " + reason);
       })
@@ -337,50 +594,48 @@ int main(int argc, char **argv) {
 
         if (authenticated_devices[&conn]) {
           if (!is_binary) {
-            if (data == "get-config") {
-              std::string jsonString = config.dump();
-              conn.send_text("config:" + jsonString);
-            } else if (data == "inc-volume") {
-              if (elevated.find(&conn) != elevated.end()) {
-                log("running inc-volume");
-                volume_inc(5);
-              }
-            } else if (data == "dec-volume") {
-              if (elevated.find(&conn) != elevated.end()) {
-                log("running dec-volume");
-                volume_dec(5);
-              }
-            } else if (data == "tog-volume") {
-              if (elevated.find(&conn) != elevated.end()) {
-                log("running tog-volume");
-                volume_toggle();
-              }
-            } else if (data == "inc-capture") {
-              if (elevated.find(&conn) != elevated.end()) {
-                log("running inc-capture");
-                capture_inc(5);
-              }
-            } else if (data == "dec-capture") {
-              if (elevated.find(&conn) != elevated.end()) {
-                log("running dec-capture");
-                capture_dec(5);
-              }
-            } else if (data == "tog-capture") {
-              if (elevated.find(&conn) != elevated.end()) {
-                log("running tog-capture");
-                capture_toggle();
+            if (data.compare(0, 10, "get-config") == 0) {
+              // get-config:<version> is answered with config-unchanged when
+              // the client already has the current config.
+              std::shared_ptr<const Snapshot> snapshot = current_snapshot();
+              if (!snapshot->config_message) {
+                conn.send_text("warming");
+              } else if (data.size() == 10) {
+                conn.send_text(*snapshot->config_message);
+              } else if (data[10] != ':') {
+                error("Invalid command: " + data);
+              } else if (data.compare(11, std::string::npos,
+                                      snapshot->config_version) == 0) {
+                conn.send_text("config-unchanged");
+              } else {
+                conn.send_text(*snapshot->versioned_config_message);
               }
-            } else if (data.length() > 10 &&
-                       data.substr(0, 10) == "run-macro:") {
-              std::string macro_name = data.substr(10);
-
-              if (loaded_macros.find(macro_name) != loaded_macros.end()) {
-                info("Running macro: " + macro_name);
-                loaded_macros[macro_name]->run();
+            } else if (!ready) {
+              conn.send_text("warming");
+            } else {
+              Command command;
+              if (parse_text_command(data, command)) {
+                run_command(conn, command);
               } else {
-                error("Invalid macro: " + macro_name);
+                error("Invalid command: " + data);
+                reject_command(conn, command);
               }
             }
+          } else if (!ready) {
+            conn.send_text("warming");
+          } else {
+            // A binary frame may hold several commands, they are run in
+            // order until the first one that fails to decode.
+            std::string_view frame = data;
+            Command command;
+            while (!frame.empty()) {
+              if (!decode_command(frame, command)) {
+                error("Invalid binary command from: " + conn.get_remote_ip());
+                reject_command(conn, command);
+                break;
+              }
+              run_command(conn, command);
+            }
           }
         } else {
           if (data.length() > 5 && data.substr(0, 5) == "auth:" &&
@@ -388,6 +643,7 @@ int main(int argc, char **argv) {
             info("Client " + conn.get_remote_ip() + " authenticated");
             authenticated_devices[&conn] = true;
             conn.send_text("auth-success");
+            welcome(conn);
           } else {
             info("Failed to authenticate with message: " + data);
             conn.send_text("auth-fail");
@@ -415,55 +671,78 @@ int main(int argc, char **argv) {
     res.end();
   });
 
+  CROW_ROUTE(app, "/metrics")([]() {
+    crow::response res(render_metrics());
+    res.set_header("Content-Type", "text/plain; version=0.0.4");
+    return res;
+  });
+
   CROW_ROUTE(app, "/icon/<path>")
   ([](const crow::request &req, crow::response &res, std::string path) {
-    for (const auto &icon : icons) {
-      if (icon[1].size() >= path.size() &&
-          icon[1].substr(0, path.size()) == path) {
-
-        std::ifstream file(icon[0], std::ios::binary);
-        if (!file.is_open()) {
-          res.code = 404;
-          res.write("File not found");
-          res.end();
-          return;
+    std::shared_ptr<const Snapshot> snapshot = current_snapshot();
+
+    // Icons are requested by macro name, the file name works as well.
+    auto it = snapshot->icons.find(path);
+    if (it == snapshot->icons.end()) {
+      size_t dot = path.find_last_of('.');
+      if (dot != std::string::npos) {
+        it = snapshot->icons.find(path.substr(0, dot));
+        if (it != snapshot->icons.end() && it->second->file != path) {
+          it = snapshot->icons.end();
         }
+      }
+    }
 
-        std::string extension;
-        size_t dotPos = icon[0].find_last_of('.');
-        if (dotPos != std::string::npos) {
-          extension = icon[0].substr(dotPos + 1);
-        }
+    if (it == snapshot->icons.end()) {
+      res.code = 404;
+      res.write("File not found");
+      res.end();
+      return;
+    }
 
-        static const std::unordered_map<std::string, std::string> mimeTypes = {
-            {"png", "image/png"},
-            {"jpg", "image/jpeg"},
-            {"jpeg", "image/jpeg"}};
+    const Icon &icon = *it->second;
 
-        auto it = mimeTypes.find(extension);
-        if (it != mimeTypes.end()) {
-          res.set_header("Content-Type", it->second);
-        } else {
-          res.set_header("Content-Type", "application/octet-stream");
-        }
+    // Versioned URLs never change their content, everything else is
+    // revalidated through the ETag.
+    res.set_header("ETag", icon.etag);
+    if (req.url_params.get("v") != nullptr) {
+      res.set_header("Cache-Control", "public, max-age=31536000, immutable");
+    } else {
+      res.set_header("Cache-Control", "no-cache");
+    }
 
-        std::ostringstream buffer;
-        buffer << file.rdbuf();
-        res.write(buffer.str());
-        res.end();
-        return;
-      }
+    if (etag_matches(req.get_header_value("If-None-Match"), icon.etag)) {
+      res.code = 304;
+      res.end();
+      return;
     }
-    res.code = 404;
-    res.write("File not found");
+
+    // Crow streams a static file from within end(), while snapshot still
+    // holds the icon and with it its file.
+    res.set_static_file_info_unsafe(icon.path);
+    res.set_header("Content-Type", icon.mime);
     res.end();
   });
 
   get_interfaces();
-  info("App ready on port 7299");
 
   if (program["--verbose"] != true)
     app.loglevel(crow::LogLevel::Warning);
 
-  app.port(7299).multithreaded().run();
+  auto server = app.port(7299).multithreaded().run_async();
+  info("Warming up on port 7299");
+
+  for (auto &task : startup) {
+    task.wait();
+  }
+  ready = true;
+  info("App ready on port 7299");
+
+  std::string config_path = get_config_path(confing_path);
+  init_watcher(config_path, initial->index.dir,
+               [config_path](const ChangeSet &changes) {
+                 reload(config_path, changes);
+               });
+
+  server.wait();
 }
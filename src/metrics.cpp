@@ -0,0 +1,39 @@
+#include "metrics.hpp"
+
+#include <deque>
+#include <mutex>
+
+// Counters are registered from static initializers of other files, so the
+// registry is created on first use.
+std::deque<Counter> &counters() {
+  static std::deque<Counter> registry;
+  return registry;
+}
+
+std::mutex &counters_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+Counter *register_counter(const char *name, const char *help) {
+  std::lock_guard<std::mutex> lock(counters_mutex());
+  Counter &counter = counters().emplace_back();
+  counter.name = name;
+  counter.help = help;
+  return &counter;
+}
+
+std::string render_metrics() {
+  std::lock_guard<std::mutex> lock(counters_mutex());
+  std::string out;
+
+  for (const Counter &counter : counters()) {
+    out += "# HELP " + std::string(counter.name) + " " + counter.help + "\n";
+    out += "# TYPE " + std::string(counter.name) + " counter\n";
+    out += std::string(counter.name) + " " +
+           std::to_string(counter.value.load(std::memory_order_relaxed)) +
+           "\n";
+  }
+
+  return out;
+}
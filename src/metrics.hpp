@@ -0,0 +1,22 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// A monotonically increasing counter, exported on /metrics.
+struct Counter {
+  const char *name;
+  const char *help;
+  std::atomic<uint64_t> value{0};
+
+  void add(uint64_t amount = 1) {
+    value.fetch_add(amount, std::memory_order_relaxed);
+  }
+};
+
+// Counters live for the whole program, the returned pointer stays valid.
+Counter *register_counter(const char *name, const char *help);
+
+// All counters in the Prometheus text format.
+std::string render_metrics();
@@ -8,6 +8,8 @@ Opcode str_to_op(const std::string &str) {
     return APP_CLOSE;
   if (str == "app_switch")
     return APP_SWITCH;
+  if (str == "app_open_wait")
+    return APP_OPEN_WAIT;
   if (str == "key_press")
     return KEY_PRESS;
   if (str == "key_release")
@@ -28,6 +30,8 @@ Opcode str_to_op(const std::string &str) {
     return VOLUME_UNMUTE;
   if (str == "volume_toggle")
     return VOLUME_TOGGLE;
+  if (str == "volume_ramp")
+    return VOLUME_RAMP;
   if (str == "capture_inc")
     return CAPTURE_INC;
   if (str == "capture_dec")
@@ -40,6 +44,26 @@ Opcode str_to_op(const std::string &str) {
     return CAPTURE_UNMUTE;
   if (str == "capture_toggle")
     return CAPTURE_TOGGLE;
+  if (str == "capture_ramp")
+    return CAPTURE_RAMP;
+  if (str == "mixer_inc")
+    return MIXER_INC;
+  if (str == "mixer_dec")
+    return MIXER_DEC;
+  if (str == "mixer_set")
+    return MIXER_SET;
+  if (str == "mixer_mute")
+    return MIXER_MUTE;
+  if (str == "mixer_unmute")
+    return MIXER_UNMUTE;
+  if (str == "mixer_toggle")
+    return MIXER_TOGGLE;
+  if (str == "mixer_ramp")
+    return MIXER_RAMP;
+  if (str == "sound_play")
+    return SOUND_PLAY;
+  if (str == "wait_window")
+    return WAIT_WINDOW;
   if (str == "wait")
     return WAIT;
   warning("Unknown action: " + str);
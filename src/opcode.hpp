@@ -9,6 +9,7 @@ enum Opcode {
   APP_OPEN,
   APP_CLOSE,
   APP_SWITCH,
+  APP_OPEN_WAIT,
 
   // Keyboard Actions
   KEY_PRESS,
@@ -23,6 +24,7 @@ enum Opcode {
   VOLUME_MUTE,
   VOLUME_UNMUTE,
   VOLUME_TOGGLE,
+  VOLUME_RAMP,
 
   // Capture Control
   CAPTURE_INC,
@@ -31,7 +33,21 @@ enum Opcode {
   CAPTURE_MUTE,
   CAPTURE_UNMUTE,
   CAPTURE_TOGGLE,
+  CAPTURE_RAMP,
 
+  // Mixer Elements
+  MIXER_INC,
+  MIXER_DEC,
+  MIXER_SET,
+  MIXER_MUTE,
+  MIXER_UNMUTE,
+  MIXER_TOGGLE,
+  MIXER_RAMP,
+
+  // Sound Playback
+  SOUND_PLAY,
+
+  WAIT_WINDOW,
   WAIT,
 };
 
@@ -0,0 +1,424 @@
+#include "player.hpp"
+#include "cache.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <alsa/asoundlib.h>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PLAYER_RATE 48000
+#define PLAYER_CHANNELS 2
+// Total output buffer, the ALSA period is a quarter of it. New sounds are
+// heard after at most one buffer.
+#define PLAYER_LATENCY_US 8000
+#define MAX_VOICES 16
+#define MAX_SOUND_SECONDS 60
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+struct Voice {
+  std::shared_ptr<const Sound> sound;
+  size_t position;
+};
+
+snd_pcm_t *pcm = nullptr;
+snd_pcm_uframes_t period_frames = 0;
+std::thread player_thread;
+std::mutex player_mutex;
+std::condition_variable player_cv;
+std::vector<Voice> voices;
+bool player_stopping = false;
+
+std::shared_ptr<const SoundBank> sound_bank;
+
+std::unordered_map<std::string, uint32_t> sound_ids;
+std::vector<std::string> sound_names;
+// Whether the last scan found the sound, indexed by id.
+std::vector<bool> sound_found;
+std::mutex sound_ids_mutex;
+
+Counter *sounds_played =
+    register_counter("macrodeck_sounds_played_total", "Sounds started");
+Counter *sound_underruns =
+    register_counter("macrodeck_sound_underruns_total",
+                     "Sound output buffer underruns");
+
+template <typename T> T read_le(const char *data) {
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+struct WaveFormat {
+  uint16_t format = 0;
+  uint16_t channels = 0;
+  uint32_t rate = 0;
+  uint16_t block_align = 0;
+  uint16_t bits = 0;
+};
+
+// Returns one sample in the range -1 to 1.
+float wave_sample(const WaveFormat &wave, const char *data) {
+  switch (wave.bits) {
+  case 8:
+    return (static_cast<uint8_t>(*data) - 128) / 128.0f;
+  case 16:
+    return read_le<int16_t>(data) / 32768.0f;
+  case 24: {
+    int32_t value = static_cast<uint8_t>(data[0]) |
+                    static_cast<uint8_t>(data[1]) << 8 |
+                    static_cast<int8_t>(data[2]) * 65536;
+    return value / 8388608.0f;
+  }
+  default:
+    if (wave.format == WAVE_FORMAT_IEEE_FLOAT)
+      return std::clamp(read_le<float>(data), -1.0f, 1.0f);
+    return read_le<int32_t>(data) / 2147483648.0f;
+  }
+}
+
+bool check_format(const WaveFormat &wave) {
+  if (wave.channels == 0 || wave.rate == 0)
+    return false;
+  if (wave.block_align != wave.channels * wave.bits / 8)
+    return false;
+  if (wave.format == WAVE_FORMAT_IEEE_FLOAT)
+    return wave.bits == 32;
+  return wave.format == WAVE_FORMAT_PCM &&
+         (wave.bits == 8 || wave.bits == 16 || wave.bits == 24 ||
+          wave.bits == 32);
+}
+
+// Decodes PCM and float WAV files. Mono is copied to both channels, extra
+// channels are dropped and other rates are linearly resampled, all once here
+// instead of on every play.
+bool decode_wave(const std::string &data, Sound &sound) {
+  if (data.size() < 12 || data.compare(0, 4, "RIFF") != 0 ||
+      data.compare(8, 4, "WAVE") != 0)
+    return false;
+
+  WaveFormat wave;
+  const char *samples = nullptr;
+  size_t samples_size = 0;
+
+  for (size_t pos = 12; pos + 8 <= data.size();) {
+    const char *chunk = data.data() + pos;
+    size_t size = read_le<uint32_t>(chunk + 4);
+    size = std::min(size, data.size() - pos - 8);
+
+    if (std::memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      wave.format = read_le<uint16_t>(chunk + 8);
+      wave.channels = read_le<uint16_t>(chunk + 10);
+      wave.rate = read_le<uint32_t>(chunk + 12);
+      wave.block_align = read_le<uint16_t>(chunk + 20);
+      wave.bits = read_le<uint16_t>(chunk + 22);
+      if (wave.format == WAVE_FORMAT_EXTENSIBLE && size >= 40)
+        wave.format = read_le<uint16_t>(chunk + 32);
+    } else if (std::memcmp(chunk, "data", 4) == 0) {
+      samples = chunk + 8;
+      samples_size = size;
+    }
+
+    pos += 8 + size + (size & 1);
+  }
+
+  if (!samples || !check_format(wave))
+    return false;
+
+  size_t frames = samples_size / wave.block_align;
+  if (frames > static_cast<size_t>(wave.rate) * MAX_SOUND_SECONDS)
+    return false;
+
+  size_t sample_bytes = wave.bits / 8;
+  auto frame_sample = [&](size_t frame, size_t channel) {
+    frame = std::min(frame, frames - 1);
+    channel = std::min<size_t>(channel, wave.channels - 1);
+    return wave_sample(wave, samples + frame * wave.block_align +
+                                 channel * sample_bytes);
+  };
+
+  size_t out_frames = frames * PLAYER_RATE / wave.rate;
+  sound.samples.resize(out_frames * PLAYER_CHANNELS);
+
+  double step = static_cast<double>(wave.rate) / PLAYER_RATE;
+  for (size_t i = 0; i < out_frames; i++) {
+    double position = i * step;
+    size_t frame = static_cast<size_t>(position);
+    float fraction = static_cast<float>(position - frame);
+
+    for (size_t channel = 0; channel < PLAYER_CHANNELS; channel++) {
+      float a = frame_sample(frame, channel);
+      float b = frame_sample(frame + 1, channel);
+      float value = std::clamp(a + (b - a) * fraction, -1.0f, 1.0f);
+      sound.samples[i * PLAYER_CHANNELS + channel] =
+          static_cast<int16_t>(std::lround(value * 32767.0f));
+    }
+  }
+
+  return true;
+}
+
+std::shared_ptr<const Sound> load_sound(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    error("Failed to load sound: " + path);
+    return nullptr;
+  }
+
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+
+  std::shared_ptr<Sound> sound = std::make_shared<Sound>();
+  if (!decode_wave(data, *sound)) {
+    error("Unsupported or invalid WAV file: " + path);
+    return nullptr;
+  }
+
+  return sound;
+}
+
+void register_sounds(std::vector<std::string> names) {
+  std::sort(names.begin(), names.end());
+
+  std::lock_guard<std::mutex> lock(sound_ids_mutex);
+  std::fill(sound_found.begin(), sound_found.end(), false);
+  for (const std::string &name : names) {
+    auto [it, added] = sound_ids.emplace(name, sound_names.size());
+    if (added) {
+      sound_names.push_back(name);
+      sound_found.push_back(true);
+    } else {
+      sound_found[it->second] = true;
+    }
+  }
+}
+
+int sound_id(const std::string &name) {
+  std::lock_guard<std::mutex> lock(sound_ids_mutex);
+  auto it = sound_ids.find(name);
+  if (it == sound_ids.end() || !sound_found[it->second])
+    return -1;
+  return static_cast<int>(it->second);
+}
+
+bool has_sound(uint32_t id) {
+  std::lock_guard<std::mutex> lock(sound_ids_mutex);
+  return id < sound_found.size() && sound_found[id];
+}
+
+size_t sound_count() {
+  std::lock_guard<std::mutex> lock(sound_ids_mutex);
+  return sound_names.size();
+}
+
+uint64_t sound_signature() {
+  std::lock_guard<std::mutex> lock(sound_ids_mutex);
+  std::string names;
+  for (const std::string &name : sound_names) {
+    names += name;
+    names += '\0';
+  }
+  return hash_bytes(names.data(), names.size());
+}
+
+std::string sound_name(uint32_t id) {
+  std::lock_guard<std::mutex> lock(sound_ids_mutex);
+  return id < sound_names.size() ? sound_names[id] : std::to_string(id);
+}
+
+// Adds samples to the output with saturation, so loud overlapping sounds
+// clip instead of wrapping around.
+void mix_samples(int16_t *out, const int16_t *in, size_t count) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(out + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_adds_epi16(a, b));
+  }
+#endif
+  for (; i < count; i++) {
+    int sum = out[i] + in[i];
+    out[i] = static_cast<int16_t>(std::clamp(sum, -32768, 32767));
+  }
+}
+
+// Mixes the next period of every voice into buffer and drops the voices
+// that have finished.
+void mix_period(std::vector<int16_t> &buffer) {
+  std::fill(buffer.begin(), buffer.end(), 0);
+
+  for (Voice &voice : voices) {
+    const std::vector<int16_t> &samples = voice.sound->samples;
+    size_t count = std::min(buffer.size(), samples.size() - voice.position);
+    mix_samples(buffer.data(), samples.data() + voice.position, count);
+    voice.position += count;
+  }
+
+  voices.erase(std::remove_if(voices.begin(), voices.end(),
+                              [](const Voice &voice) {
+                                return voice.position >=
+                                       voice.sound->samples.size();
+                              }),
+               voices.end());
+}
+
+bool write_period(const std::vector<int16_t> &buffer) {
+  const int16_t *data = buffer.data();
+  snd_pcm_uframes_t left = buffer.size() / PLAYER_CHANNELS;
+
+  while (left > 0) {
+    snd_pcm_sframes_t written = snd_pcm_writei(pcm, data, left);
+    if (written < 0) {
+      if (written == -EPIPE)
+        sound_underruns->add();
+      int err = snd_pcm_recover(pcm, static_cast<int>(written), 1);
+      if (err < 0) {
+        error(std::string("Failed to play sound: ") + snd_strerror(err));
+        return false;
+      }
+      continue;
+    }
+
+    data += written * PLAYER_CHANNELS;
+    left -= written;
+  }
+
+  return true;
+}
+
+// Writes one period at a time while anything is playing. Once the last voice
+// ends the buffer is drained and the device waits, prepared, for the next
+// sound, so nothing is written while idle.
+void player_loop() {
+  std::vector<int16_t> buffer(period_frames * PLAYER_CHANNELS);
+  bool running = false;
+
+  std::unique_lock<std::mutex> lock(player_mutex);
+  while (true) {
+    if (!running) {
+      player_cv.wait(lock,
+                     [] { return player_stopping || !voices.empty(); });
+    }
+
+    if (player_stopping)
+      return;
+
+    if (voices.empty()) {
+      lock.unlock();
+      snd_pcm_drain(pcm);
+      snd_pcm_prepare(pcm);
+      running = false;
+      lock.lock();
+      continue;
+    }
+
+    mix_period(buffer);
+    lock.unlock();
+
+    running = write_period(buffer);
+    lock.lock();
+
+    if (!running)
+      voices.clear();
+  }
+}
+
+void init_player(const std::string &device) {
+  std::lock_guard<std::mutex> lock(player_mutex);
+
+  int err = snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+  if (err < 0) {
+    error("Unable to open sound device " + device + ": " + snd_strerror(err));
+    pcm = nullptr;
+    return;
+  }
+
+  snd_pcm_uframes_t buffer_frames;
+  err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE,
+                           SND_PCM_ACCESS_RW_INTERLEAVED, PLAYER_CHANNELS,
+                           PLAYER_RATE, 1, PLAYER_LATENCY_US);
+  if (err >= 0)
+    err = snd_pcm_get_params(pcm, &buffer_frames, &period_frames);
+  if (err < 0 || period_frames == 0) {
+    error("Unable to configure sound device " + device + ": " +
+          snd_strerror(err));
+    snd_pcm_close(pcm);
+    pcm = nullptr;
+    return;
+  }
+
+  player_stopping = false;
+  player_thread = std::thread(player_loop);
+}
+
+void clean_player() {
+  {
+    std::lock_guard<std::mutex> lock(player_mutex);
+    player_stopping = true;
+  }
+  player_cv.notify_all();
+  if (player_thread.joinable())
+    player_thread.join();
+
+  std::lock_guard<std::mutex> lock(player_mutex);
+  voices.clear();
+  if (pcm) {
+    snd_pcm_drop(pcm);
+    snd_pcm_close(pcm);
+    pcm = nullptr;
+  }
+}
+
+void set_sound_bank(std::shared_ptr<const SoundBank> bank) {
+  std::atomic_store(&sound_bank, std::move(bank));
+}
+
+void sound_play(uint32_t id) {
+  std::shared_ptr<const SoundBank> bank = std::atomic_load(&sound_bank);
+  std::shared_ptr<const Sound> sound;
+  if (bank && id < bank->size())
+    sound = (*bank)[id];
+
+  if (!sound) {
+    warning("Sound is not loaded: " + sound_name(id));
+    return;
+  }
+  if (sound->samples.empty())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(player_mutex);
+    if (!pcm || player_stopping) {
+      error("Sound output is not initialized");
+      return;
+    }
+
+    if (voices.size() >= MAX_VOICES) {
+      warning("Dropping sound " + sound_name(id) +
+              ": too many sounds playing");
+      return;
+    }
+
+    voices.push_back({std::move(sound), 0});
+  }
+  sounds_played->add();
+  player_cv.notify_one();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A sound file decoded to interleaved 16 bit stereo at the player rate, so
+// playing it is a plain copy into the output.
+struct Sound {
+  std::vector<int16_t> samples;
+};
+
+// Decoded sounds indexed by sound id, one bank per snapshot. Sounds that
+// are gone or failed to load leave their slot empty.
+using SoundBank = std::vector<std::shared_ptr<const Sound>>;
+
+std::shared_ptr<const Sound> load_sound(const std::string &path);
+
+// Sets the sounds found by a scan. New names get the next ids, in name
+// order, and ids are never reused, so compiled macros stay valid.
+void register_sounds(std::vector<std::string> names);
+// Returns the id of a sound, or -1 when the last scan found none by that
+// name.
+int sound_id(const std::string &name);
+// Whether the last scan found the sound with this id.
+bool has_sound(uint32_t id);
+size_t sound_count();
+// Changes whenever sound names or ids change.
+uint64_t sound_signature();
+
+// Opens the ALSA PCM device once and keeps it open, any PCM name works,
+// including the null and file plugins.
+void init_player(const std::string &device);
+void clean_player();
+
+void set_sound_bank(std::shared_ptr<const SoundBank> bank);
+// Starts playing a sound on top of whatever is already playing.
+void sound_play(uint32_t id);
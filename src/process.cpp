@@ -0,0 +1,214 @@
+#include "process.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#define PROCESS_TIMEOUT_MS 5000
+
+extern char **environ;
+
+int signal_fd = -1;
+int reaper_stop_fd = -1;
+std::thread reaper_thread;
+
+// Processes started by spawn_process that have not been reaped yet.
+std::unordered_map<pid_t, ExitCallback> children;
+std::mutex children_mutex;
+
+Counter *processes_spawned =
+    register_counter("macrodeck_processes_spawned_total", "Processes started");
+Counter *spawn_failures =
+    register_counter("macrodeck_process_spawn_failures_total",
+                     "Processes that could not be started");
+Counter *processes_exited =
+    register_counter("macrodeck_processes_exited_total", "Processes reaped");
+Counter *processes_failed =
+    register_counter("macrodeck_processes_failed_total",
+                     "Processes that exited with a non-zero status or signal");
+
+// Only our own children are waited for, so pclose and other waitpid users
+// keep working.
+void reap_children() {
+  std::vector<std::pair<ExitCallback, int>> exited;
+  {
+    std::lock_guard<std::mutex> lock(children_mutex);
+    for (auto it = children.begin(); it != children.end();) {
+      int status;
+      pid_t pid = waitpid(it->first, &status, WNOHANG);
+      if (pid == 0) {
+        ++it;
+        continue;
+      }
+
+      if (pid < 0)
+        status = -1;
+      exited.emplace_back(std::move(it->second), status);
+      it = children.erase(it);
+    }
+  }
+
+  for (auto &[callback, status] : exited) {
+    processes_exited->add();
+    if (status != 0)
+      processes_failed->add();
+    if (callback)
+      callback(status);
+  }
+}
+
+void reaper_loop() {
+  struct pollfd fds[2] = {{signal_fd, POLLIN, 0}, {reaper_stop_fd, POLLIN, 0}};
+
+  while (true) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      error(std::string("Failed to wait for processes: ") + strerror(errno));
+      return;
+    }
+
+    if (fds[1].revents & POLLIN)
+      return;
+
+    // Signals coalesce, one read covers any number of exited children.
+    struct signalfd_siginfo info[8];
+    while (read(signal_fd, info, sizeof(info)) > 0) {
+    }
+
+    reap_children();
+  }
+}
+
+bool init_processes() {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+
+  if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+    error("Failed to block SIGCHLD");
+    return false;
+  }
+
+  signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  reaper_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (signal_fd < 0 || reaper_stop_fd < 0) {
+    error(std::string("Failed to create process reaper: ") + strerror(errno));
+    clean_processes();
+    return false;
+  }
+
+  reaper_thread = std::thread(reaper_loop);
+  return true;
+}
+
+void clean_processes() {
+  if (reaper_thread.joinable()) {
+    uint64_t value = 1;
+    if (write(reaper_stop_fd, &value, sizeof(value)) == sizeof(value))
+      reaper_thread.join();
+    else
+      reaper_thread.detach();
+  }
+
+  if (signal_fd >= 0) {
+    close(signal_fd);
+    signal_fd = -1;
+  }
+  if (reaper_stop_fd >= 0) {
+    close(reaper_stop_fd);
+    reaper_stop_fd = -1;
+  }
+}
+
+// posix_spawnp starts the child with vfork semantics, so the cost does not
+// depend on the size of the server. Children get an empty signal mask and
+// default SIGPIPE instead of what the server uses.
+pid_t spawn_process(const std::vector<std::string> &argv,
+                    ExitCallback callback) {
+  if (argv.empty())
+    return -1;
+
+  std::vector<char *> c_args;
+  for (const auto &arg : argv) {
+    c_args.push_back(const_cast<char *>(arg.c_str()));
+  }
+  c_args.push_back(nullptr);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  sigaddset(&defaults, SIGCHLD);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                                      POSIX_SPAWN_SETSIGDEF);
+
+  pid_t pid;
+  int err;
+  {
+    // Registered before the reaper can look, even if the child exits at once.
+    std::lock_guard<std::mutex> lock(children_mutex);
+    err = posix_spawnp(&pid, c_args[0], nullptr, &attr, c_args.data(),
+                       environ);
+    if (err == 0)
+      children.emplace(pid, std::move(callback));
+  }
+  posix_spawnattr_destroy(&attr);
+
+  if (err != 0) {
+    spawn_failures->add();
+    error("Failed to execute " + argv[0] + ": " + strerror(err));
+    return -1;
+  }
+
+  processes_spawned->add();
+  return pid;
+}
+
+bool run_process(const std::vector<std::string> &argv) {
+  auto exited = std::make_shared<std::promise<int>>();
+  std::future<int> status = exited->get_future();
+
+  pid_t pid = spawn_process(
+      argv, [exited](int status) { exited->set_value(status); });
+  if (pid < 0)
+    return false;
+
+  if (status.wait_for(std::chrono::milliseconds(PROCESS_TIMEOUT_MS)) !=
+      std::future_status::ready) {
+    warning("Gave up waiting for " + argv[0]);
+    return false;
+  }
+
+  int result = status.get();
+  if (result != 0) {
+    warning(argv[0] + " failed with " +
+            (WIFSIGNALED(result)
+                 ? "signal " + std::to_string(WTERMSIG(result))
+                 : "status " + std::to_string(WEXITSTATUS(result))));
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Called from the reaper thread with the wait status of an exited process.
+using ExitCallback = std::function<void(int status)>;
+
+// Blocks SIGCHLD and starts the reaper. Must run before any other thread is
+// started, so that every thread inherits the blocked signal.
+bool init_processes();
+void clean_processes();
+
+// Starts argv[0] from PATH without copying the server, returns its pid or -1.
+pid_t spawn_process(const std::vector<std::string> &argv,
+                    ExitCallback callback = nullptr);
+// Runs a short helper command to completion, returns whether it exited
+// with status 0.
+bool run_process(const std::vector<std::string> &argv);
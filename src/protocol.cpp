@@ -0,0 +1,98 @@
+#include "protocol.hpp"
+
+#include <charconv>
+#include <unordered_map>
+
+bool read_varint(std::string_view &frame, uint64_t &value) {
+  value = 0;
+
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (frame.empty())
+      return false;
+
+    uint8_t byte = static_cast<uint8_t>(frame.front());
+    frame.remove_prefix(1);
+
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+
+  return false;
+}
+
+// Decodes the next command of a binary frame and advances past it. An
+// invalid command still yields its request id when the operands before it
+// could be read.
+bool decode_command(std::string_view &frame, Command &command) {
+  command = Command();
+
+  if (frame.empty())
+    return false;
+
+  uint8_t op = static_cast<uint8_t>(frame.front());
+  frame.remove_prefix(1);
+
+  bool has_request = op & CMD_REQUEST_FLAG;
+  op &= ~CMD_REQUEST_FLAG;
+
+  // Without a known opcode the operands can not be told apart.
+  if (op == CMD_INVALID || op >= CMD_RUN_MACRO_NAME)
+    return false;
+  command.op = static_cast<CommandOp>(op);
+
+  bool valid = true;
+  if (command.op == CMD_RUN_MACRO) {
+    uint64_t id;
+    if (!read_varint(frame, id))
+      return false;
+    valid = id <= UINT32_MAX;
+    command.macro = static_cast<uint32_t>(id);
+  }
+
+  if (has_request) {
+    if (!read_varint(frame, command.request))
+      return false;
+    command.has_request = true;
+  }
+
+  return valid;
+}
+
+bool parse_text_command(std::string_view text, Command &command) {
+  static const std::unordered_map<std::string_view, CommandOp> commands = {
+      {"inc-volume", CMD_INC_VOLUME},   {"dec-volume", CMD_DEC_VOLUME},
+      {"tog-volume", CMD_TOG_VOLUME},   {"inc-capture", CMD_INC_CAPTURE},
+      {"dec-capture", CMD_DEC_CAPTURE}, {"tog-capture", CMD_TOG_CAPTURE},
+  };
+
+  command = Command();
+
+  // "req:<id>:<command>" attaches a request id to a text command.
+  if (text.compare(0, 4, "req:") == 0) {
+    size_t colon = text.find(':', 4);
+    if (colon == std::string_view::npos)
+      return false;
+
+    const char *end = text.data() + colon;
+    auto [ptr, ec] = std::from_chars(text.data() + 4, end, command.request);
+    if (ec != std::errc() || ptr != end)
+      return false;
+
+    command.has_request = true;
+    text.remove_prefix(colon + 1);
+  }
+
+  if (text.size() > 10 && text.compare(0, 10, "run-macro:") == 0) {
+    command.op = CMD_RUN_MACRO_NAME;
+    command.name = text.substr(10);
+    return true;
+  }
+
+  auto it = commands.find(text);
+  if (it == commands.end())
+    return false;
+
+  command.op = it->second;
+  return true;
+}
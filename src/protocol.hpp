@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Commands sent by clients over the websocket. Text messages use the old
+// names ("inc-volume", "run-macro:<name>"), binary frames hold one or more
+// commands encoded as an opcode byte followed by LEB128 varint operands:
+//
+//   CMD_RUN_MACRO  macro_id
+//   CMD_*_VOLUME, CMD_*_CAPTURE
+//
+// Setting CMD_REQUEST_FLAG on the opcode appends a request id operand, text
+// commands take it as a "req:<id>:" prefix. Commands with a request id are
+// answered with event:{"request", "state", "time"} messages, where state is
+// accepted, started, finished or failed and time is in microseconds since
+// the epoch.
+enum CommandOp : uint8_t {
+  CMD_INVALID,
+
+  CMD_RUN_MACRO,
+
+  CMD_INC_VOLUME,
+  CMD_DEC_VOLUME,
+  CMD_TOG_VOLUME,
+
+  CMD_INC_CAPTURE,
+  CMD_DEC_CAPTURE,
+  CMD_TOG_CAPTURE,
+
+  // Text only, the macro is looked up by name.
+  CMD_RUN_MACRO_NAME,
+};
+
+#define CMD_REQUEST_FLAG 0x80
+
+struct Command {
+  CommandOp op = CMD_INVALID;
+  uint32_t macro = 0;
+  std::string_view name;
+  bool has_request = false;
+  uint64_t request = 0;
+};
+
+// Both return false for an invalid command. has_request is still set if its
+// request id was read, so the client can be sent a failed event for it.
+bool decode_command(std::string_view &frame, Command &command);
+bool parse_text_command(std::string_view text, Command &command);
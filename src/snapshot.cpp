@@ -0,0 +1,178 @@
+#include "snapshot.hpp"
+#include "cache.hpp"
+#include "log.hpp"
+
+#include <atomic>
+#include <mutex>
+
+std::shared_ptr<const Snapshot> published = std::make_shared<Snapshot>();
+
+std::shared_ptr<const Snapshot> current_snapshot() {
+  return std::atomic_load(&published);
+}
+
+// The sound bank is handed to the player along with the snapshot, so
+// sound_play always sees the sounds of the current snapshot.
+void publish_snapshot(std::shared_ptr<const Snapshot> next) {
+  set_sound_bank(next->sounds);
+  std::atomic_store(&published, std::move(next));
+}
+
+// Ids are handed out once per name and never reused, so the ids in a config
+// a client still holds stay valid across reloads.
+std::unordered_map<std::string, uint32_t> macro_ids;
+std::mutex macro_ids_mutex;
+
+uint32_t macro_id(const std::string &name) {
+  std::lock_guard<std::mutex> lock(macro_ids_mutex);
+  return macro_ids.emplace(name, macro_ids.size()).first->second;
+}
+
+void load_icons(Snapshot &snapshot, const Snapshot *previous,
+                const std::unordered_set<std::string> &changed) {
+  snapshot.icons.clear();
+
+  for (const auto &name : get_macro_names(snapshot.config)) {
+    std::array<std::string, 2> file = get_icon(snapshot.index, name);
+    if (file[0] == "" || file[1] == "")
+      continue;
+
+    if (previous && changed.find(name) == changed.end()) {
+      auto it = previous->icons.find(name);
+      if (it != previous->icons.end() && it->second->file == file[1]) {
+        snapshot.icons.emplace(name, it->second);
+        continue;
+      }
+    }
+
+    std::shared_ptr<const Icon> icon = load_icon(file[0], file[1]);
+    if (icon) {
+      snapshot.icons.emplace(name, std::move(icon));
+    }
+  }
+}
+
+// Sounds are decoded once, unchanged ones are shared with the previous
+// snapshot. Ids are registered first, so macros loaded afterwards can refer
+// to every sound of this scan.
+void load_sounds(Snapshot &snapshot, const Snapshot *previous,
+                 const std::unordered_set<std::string> &changed) {
+  std::vector<std::string> names;
+  for (const auto &[name, path] : snapshot.index.sounds) {
+    names.push_back(name);
+  }
+  register_sounds(names);
+
+  std::shared_ptr<SoundBank> bank =
+      std::make_shared<SoundBank>(sound_count());
+  for (const auto &[name, path] : snapshot.index.sounds) {
+    uint32_t id = sound_id(name);
+    if (previous && previous->sounds && id < previous->sounds->size() &&
+        changed.find(name) == changed.end() && (*previous->sounds)[id]) {
+      (*bank)[id] = (*previous->sounds)[id];
+      continue;
+    }
+
+    (*bank)[id] = load_sound(path);
+  }
+
+  snapshot.sounds = std::move(bank);
+}
+
+void annotate_buttons(const Snapshot &snapshot, json &deck) {
+  if (!deck.is_object() || !deck.contains("buttons") ||
+      !deck["buttons"].is_array())
+    return;
+
+  for (json &button : deck["buttons"]) {
+    if (!button.is_object() || !button.contains("macro") ||
+        !button["macro"].is_string())
+      continue;
+
+    std::string name = button["macro"].get<std::string>();
+    button["id"] = macro_id(name);
+
+    auto it = snapshot.icons.find(name);
+    if (it == snapshot.icons.end())
+      continue;
+
+    const Icon &icon = *it->second;
+    button["icon"] = {
+        {"url", "/icon/" + name + "?v=" + icon.version},
+        {"hash", icon.version},
+        {"width", icon.width},
+        {"height", icon.height},
+    };
+  }
+}
+
+// The config as sent to clients. Every button gets the id of its macro for
+// the binary protocol, and buttons with an icon get a manifest entry so the
+// page can render the whole grid without probing for icons.
+void build_client_config(Snapshot &snapshot) {
+  snapshot.client_config = snapshot.config;
+
+  if (snapshot.client_config.is_array()) {
+    for (json &deck : snapshot.client_config) {
+      annotate_buttons(snapshot, deck);
+    }
+  } else {
+    annotate_buttons(snapshot, snapshot.client_config);
+  }
+
+  // The version is a hash of the serialized config, so clients can keep
+  // their copy across reconnects and only fetch it again when it changed.
+  std::string dump = snapshot.client_config.dump();
+  snapshot.config_version = hash_hex(hash_bytes(dump.data(), dump.size()));
+  snapshot.config_message = std::make_shared<const std::string>("config:" +
+                                                                dump);
+  snapshot.versioned_config_message = std::make_shared<const std::string>(
+      "config-v:" + snapshot.config_version + ":" + dump);
+}
+
+// Only macros that are new to the config or listed in `changed` are loaded,
+// everything else is shared with the previous snapshot.
+void load_macros(Snapshot &snapshot, const Snapshot *previous,
+                 const std::unordered_set<std::string> &changed) {
+  std::vector<std::string> names;
+
+  snapshot.macros.clear();
+  for (const auto &name : get_macro_names(snapshot.config)) {
+    if (previous && changed.find(name) == changed.end()) {
+      auto it = previous->macros.find(name);
+      if (it != previous->macros.end()) {
+        snapshot.macros.emplace(name, it->second);
+        continue;
+      }
+    }
+    names.push_back(name);
+  }
+
+  std::vector<Macro *> compiled =
+      load_macros(snapshot.index, names, previous == nullptr);
+
+  for (size_t i = 0; i < names.size(); i++) {
+    if (compiled[i]) {
+      log((previous ? "Reloaded macro: " : "Loaded macro: ") + names[i]);
+      snapshot.macros[names[i]] = std::shared_ptr<const Macro>(compiled[i]);
+      continue;
+    }
+
+    warning("Failed to load macro: " + names[i]);
+    if (previous) {
+      auto it = previous->macros.find(names[i]);
+      if (it != previous->macros.end()) {
+        warning("Keeping previous version of macro: " + names[i]);
+        snapshot.macros.emplace(names[i], it->second);
+      }
+    }
+  }
+
+  snapshot.macro_table.clear();
+  for (const auto &[name, macro] : snapshot.macros) {
+    uint32_t id = macro_id(name);
+    if (id >= snapshot.macro_table.size())
+      snapshot.macro_table.resize(id + 1);
+    snapshot.macro_table[id] = {name, macro};
+  }
+}
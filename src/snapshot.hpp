@@ -0,0 +1,52 @@
+#pragma once
+
+#include "icon.hpp"
+#include "loader.hpp"
+#include "macro.hpp"
+#include "nlohmann/json.hpp"
+#include "player.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using json = nlohmann::json;
+
+struct MacroSlot {
+  std::string name;
+  std::shared_ptr<const Macro> macro;
+};
+
+// Everything built from the config directory. A published snapshot is never
+// modified; reloads build a new one and swap it in, while readers and running
+// macros keep the snapshot they started with.
+struct Snapshot {
+  json config;
+  json client_config;
+  // client_config serialized once per snapshot, as sent over the socket.
+  std::string config_version;
+  std::shared_ptr<const std::string> config_message;
+  std::shared_ptr<const std::string> versioned_config_message;
+  ConfigIndex index;
+  std::unordered_map<std::string, std::shared_ptr<const Macro>> macros;
+  // The same macros indexed by their id, empty slots for unknown ids.
+  std::vector<MacroSlot> macro_table;
+  std::unordered_map<std::string, std::shared_ptr<const Icon>> icons;
+  std::shared_ptr<const SoundBank> sounds;
+};
+
+std::shared_ptr<const Snapshot> current_snapshot();
+void publish_snapshot(std::shared_ptr<const Snapshot> snapshot);
+
+uint32_t macro_id(const std::string &name);
+
+void load_icons(Snapshot &snapshot, const Snapshot *previous,
+                const std::unordered_set<std::string> &changed);
+void load_sounds(Snapshot &snapshot, const Snapshot *previous,
+                 const std::unordered_set<std::string> &changed);
+void build_client_config(Snapshot &snapshot);
+void load_macros(Snapshot &snapshot, const Snapshot *previous,
+                 const std::unordered_set<std::string> &changed);
@@ -1,233 +1,726 @@
 #include "sound.hpp"
+#include "cache.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 
 #include <algorithm>
 #include <alsa/asoundlib.h>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+// A sound card, opened once and shared by all of its elements.
+struct Card {
+  std::string name;
+  snd_mixer_t *mixer = nullptr;
+  size_t fd_offset = 0;
+  size_t fd_count = 0;
+};
+
+// One simple mixer element with its last known state. The state is kept
+// current by the mixer thread, so actions never have to query ALSA.
+struct Control {
+  MixerElement config;
+
+  Card *card = nullptr;
+  snd_mixer_elem_t *elem = nullptr;
+
+  long min = 0;
+  long max = 0;
+  long volume = 0;
+  int enabled = 1;
+
+  // Commands received since the last tick. A set replaces everything before
+  // it, later steps are relative to the set volume.
+  bool pending = false;
+  bool pending_set = false;
+  long pending_volume = 0;
+  long pending_delta = 0;
+  int pending_enabled = -1;
+  bool pending_toggle = false;
+
+  // Running ramp, advanced by the mixer thread. Any other level change
+  // cancels it, a new ramp replaces it.
+  bool ramping = false;
+  long ramp_from = 0;
+  long ramp_to = 0;
+  RampCurve ramp_curve = RAMP_LINEAR;
+  std::chrono::steady_clock::time_point ramp_start{};
+  std::chrono::milliseconds ramp_duration{0};
+};
+
+#define MIXER_TICK_MS 20
+#define RAMP_UPDATE_MS 10
+
+// Controls are indexed by element id. The registry only changes before
+// init_alsa, so ids stay valid for as long as the process runs.
+std::deque<Card> cards;
+std::deque<Control> controls = {
+    {{"master", "default", "Master", 0, false}},
+    {{"capture", "default", "Capture", 0, true}},
+};
+std::unordered_map<std::string, uint32_t> element_ids = {
+    {"master", MIXER_MASTER},
+    {"capture", MIXER_CAPTURE},
+};
+bool mixers_opened = false;
+
+std::mutex mixer_mutex;
+MixerListener mixer_listener;
+std::thread mixer_thread;
+int mixer_wake_fd = -1;
+bool mixer_stopping = false;
+int mixer_tick_ms = MIXER_TICK_MS;
+
+Counter *mixer_requested =
+    register_counter("macrodeck_mixer_commands_total",
+                     "Volume and capture commands received");
+Counter *mixer_applied =
+    register_counter("macrodeck_mixer_writes_total",
+                     "Volume and switch writes made to ALSA");
+
+std::string describe(const Control &control) {
+  return "mixer element " + control.config.name + " (" +
+         control.config.element + " on " + control.config.card + ")";
+}
 
-snd_mixer_t *out_mixer = nullptr;
-snd_mixer_selem_id_t *out_sid = nullptr;
-snd_mixer_elem_t *out_elem = nullptr;
+bool operator==(const MixerElement &a, const MixerElement &b) {
+  return a.name == b.name && a.card == b.card && a.element == b.element &&
+         a.index == b.index && a.capture == b.capture;
+}
 
-snd_mixer_t *in_mixer = nullptr;
-snd_mixer_selem_id_t *in_sid = nullptr;
-snd_mixer_elem_t *in_elem = nullptr;
+bool configure_mixers(const std::vector<MixerElement> &elements) {
+  std::lock_guard<std::mutex> lock(mixer_mutex);
 
-void init_alsa() {
-  snd_mixer_open(&out_mixer, 0);
-  snd_mixer_attach(out_mixer, "default");
-  snd_mixer_selem_register(out_mixer, nullptr, nullptr);
-  snd_mixer_load(out_mixer);
+  if (mixers_opened)
+    return false;
 
-  snd_mixer_open(&in_mixer, 0);
-  snd_mixer_attach(in_mixer, "default");
-  snd_mixer_selem_register(in_mixer, nullptr, nullptr);
-  snd_mixer_load(in_mixer);
+  for (const MixerElement &element : elements) {
+    auto it = element_ids.find(element.name);
+    if (it != element_ids.end()) {
+      controls[it->second].config = element;
+      continue;
+    }
 
-  snd_mixer_selem_id_alloca(&out_sid);
-  snd_mixer_selem_id_set_index(out_sid, 0);
-  snd_mixer_selem_id_set_name(out_sid, "Master");
+    element_ids.emplace(element.name, controls.size());
+    controls.push_back({element});
+  }
 
-  snd_mixer_selem_id_alloca(&in_sid);
-  snd_mixer_selem_id_set_index(in_sid, 0);
-  snd_mixer_selem_id_set_name(in_sid, "Capture");
+  return true;
+}
+
+int mixer_element(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mixer_mutex);
+  auto it = element_ids.find(name);
+  return it == element_ids.end() ? -1 : static_cast<int>(it->second);
+}
+
+size_t mixer_element_count() {
+  std::lock_guard<std::mutex> lock(mixer_mutex);
+  return controls.size();
+}
 
-  out_elem = snd_mixer_find_selem(out_mixer, out_sid);
-  if (!out_elem) {
-    error("Unable to find master volume control");
+uint64_t mixer_signature() {
+  std::lock_guard<std::mutex> lock(mixer_mutex);
+  std::string names;
+  for (const Control &control : controls) {
+    names += control.config.name;
+    names += '\0';
   }
+  return hash_bytes(names.data(), names.size());
+}
+
+void read_control(Control &control) {
+  if (!control.elem)
+    return;
 
-  in_elem = snd_mixer_find_selem(in_mixer, in_sid);
-  if (!in_elem) {
-    error("Unable to find master capture control");
+  if (control.config.capture) {
+    snd_mixer_selem_get_capture_volume_range(control.elem, &control.min,
+                                             &control.max);
+    snd_mixer_selem_get_capture_volume(control.elem, SND_MIXER_SCHN_FRONT_LEFT,
+                                       &control.volume);
+    snd_mixer_selem_get_capture_switch(control.elem, SND_MIXER_SCHN_FRONT_LEFT,
+                                       &control.enabled);
+  } else {
+    snd_mixer_selem_get_playback_volume_range(control.elem, &control.min,
+                                              &control.max);
+    snd_mixer_selem_get_playback_volume(control.elem, SND_MIXER_SCHN_FRONT_LEFT,
+                                        &control.volume);
+    snd_mixer_selem_get_playback_switch(control.elem, SND_MIXER_SCHN_FRONT_LEFT,
+                                        &control.enabled);
   }
 }
 
-void clean_alsa() {
-  if (out_mixer) {
-    snd_mixer_close(out_mixer);
+// A card that failed to open is remembered, so it is only reported once.
+Card *open_card(const std::string &name) {
+  for (Card &card : cards) {
+    if (card.name == name)
+      return card.mixer ? &card : nullptr;
   }
-  if (in_mixer) {
-    snd_mixer_close(in_mixer);
+
+  Card &card = cards.emplace_back();
+  card.name = name;
+
+  snd_mixer_t *mixer;
+  if (snd_mixer_open(&mixer, 0) < 0) {
+    error("Unable to open mixer for card " + name);
+    return nullptr;
+  }
+
+  if (snd_mixer_attach(mixer, name.c_str()) < 0 ||
+      snd_mixer_selem_register(mixer, nullptr, nullptr) < 0 ||
+      snd_mixer_load(mixer) < 0) {
+    error("Unable to load mixer for card " + name);
+    snd_mixer_close(mixer);
+    return nullptr;
   }
+
+  card.mixer = mixer;
+  return &card;
 }
 
-void volume_inc(int amount) {
-  if (!out_elem) {
-    error("Master volume control is not initialized");
-    return;
+bool open_control(Control &control) {
+  control.card = open_card(control.config.card);
+  if (!control.card) {
+    error("Unable to open " + describe(control));
+    return false;
   }
 
-  long min, max;
-  snd_mixer_selem_get_playback_volume_range(out_elem, &min, &max);
+  snd_mixer_selem_id_t *sid;
+  snd_mixer_selem_id_alloca(&sid);
+  snd_mixer_selem_id_set_index(sid, control.config.index);
+  snd_mixer_selem_id_set_name(sid, control.config.element.c_str());
 
-  long volume;
-  snd_mixer_selem_get_playback_volume(out_elem, SND_MIXER_SCHN_FRONT_LEFT,
-                                      &volume);
+  control.elem = snd_mixer_find_selem(control.card->mixer, sid);
+  if (!control.elem) {
+    error("Unable to find " + describe(control));
+    return false;
+  }
 
-  float amount_f = std::clamp(static_cast<float>(amount) / 100.0f, 0.0f, 1.0f);
+  read_control(control);
+  return true;
+}
 
-  volume += (max - min) * amount_f;
-  if (volume > max)
-    volume = max;
+int percent(const Control &control) {
+  if (control.max <= control.min)
+    return 0;
+  return static_cast<int>(std::lround((control.volume - control.min) * 100.0 /
+                                      (control.max - control.min)));
+}
+
+MixerState current_state() {
+  const Control &out = controls[MIXER_MASTER];
+  const Control &in = controls[MIXER_CAPTURE];
 
-  snd_mixer_selem_set_playback_volume_all(out_elem, volume);
+  MixerState state;
+  state.volume = percent(out);
+  state.muted = !out.enabled;
+  state.capture = percent(in);
+  state.capture_muted = !in.enabled;
+  return state;
 }
 
-void volume_dec(int amount) {
-  if (!out_elem) {
-    error("Master volume control is not initialized");
-    return;
+bool any_pending() {
+  for (const Control &control : controls) {
+    if (control.pending)
+      return true;
   }
+  return false;
+}
 
-  long min, max;
-  snd_mixer_selem_get_playback_volume_range(out_elem, &min, &max);
+bool any_ramping() {
+  for (const Control &control : controls) {
+    if (control.ramping)
+      return true;
+  }
+  return false;
+}
 
-  long volume;
-  snd_mixer_selem_get_playback_volume(out_elem, SND_MIXER_SCHN_FRONT_LEFT,
-                                      &volume);
+bool operator!=(const MixerState &a, const MixerState &b) {
+  return a.volume != b.volume || a.muted != b.muted ||
+         a.capture != b.capture || a.capture_muted != b.capture_muted;
+}
 
-  float amount_f = std::clamp(static_cast<float>(amount) / 100.0f, 0.0f, 1.0f);
+// Listeners are called without mixer_mutex held.
+void notify_mixer(const MixerState &state, const MixerState &previous) {
+  if (state != previous && mixer_listener)
+    mixer_listener(state, previous);
+}
 
-  volume -= (max - min) * amount_f;
-  if (volume > max)
-    volume = max;
+void set_volume(Control &control, long volume) {
+  volume = std::clamp(volume, control.min, control.max);
+  if (control.config.capture) {
+    snd_mixer_selem_set_capture_volume_all(control.elem, volume);
+  } else {
+    snd_mixer_selem_set_playback_volume_all(control.elem, volume);
+  }
+  control.volume = volume;
+  mixer_applied->add();
+}
 
-  snd_mixer_selem_set_playback_volume_all(out_elem, volume);
+void set_enabled(Control &control, int enabled) {
+  if (control.config.capture) {
+    snd_mixer_selem_set_capture_switch_all(control.elem, enabled);
+  } else {
+    snd_mixer_selem_set_playback_switch_all(control.elem, enabled);
+  }
+  control.enabled = enabled;
+  mixer_applied->add();
 }
 
-void volume_set(int amount) {
-  if (!out_elem) {
-    error("Master volume control is not initialized");
+// Turns the commands collected since the last tick into at most one volume
+// and one switch write.
+void apply_control(Control &control) {
+  if (!control.pending || !control.elem)
     return;
+
+  if (control.pending_set || control.pending_delta != 0) {
+    long base = control.pending_set ? control.pending_volume : control.volume;
+    long volume =
+        std::clamp(base + control.pending_delta, control.min, control.max);
+    if (volume != control.volume)
+      set_volume(control, volume);
   }
 
-  long min, max;
-  snd_mixer_selem_get_playback_volume_range(out_elem, &min, &max);
+  int enabled = control.enabled;
+  if (control.pending_enabled >= 0) {
+    enabled = control.pending_enabled;
+  } else if (control.pending_toggle) {
+    enabled = !enabled;
+  }
+  if (enabled != control.enabled)
+    set_enabled(control, enabled);
+
+  control.pending = false;
+  control.pending_set = false;
+  control.pending_delta = 0;
+  control.pending_enabled = -1;
+  control.pending_toggle = false;
+}
 
-  float amount_f = std::clamp(static_cast<float>(amount) / 100.0f, 0.0f, 1.0f);
+double ramp_progress(RampCurve curve, double t) {
+  switch (curve) {
+  case RAMP_EASE_IN:
+    return t * t;
+  case RAMP_EASE_OUT:
+    return 1.0 - (1.0 - t) * (1.0 - t);
+  case RAMP_EASE:
+    return t * t * (3.0 - 2.0 * t);
+  default:
+    return t;
+  }
+}
+
+void advance_ramp(Control &control,
+                  std::chrono::steady_clock::time_point now) {
+  if (!control.ramping || !control.elem)
+    return;
+
+  double t = 1.0;
+  if (control.ramp_duration.count() > 0) {
+    t = std::chrono::duration<double>(now - control.ramp_start) /
+        control.ramp_duration;
+    t = std::clamp(t, 0.0, 1.0);
+  }
 
-  long volume = min + static_cast<long>(std::round((max - min) * amount_f));
+  long volume = control.ramp_from +
+                std::lround((control.ramp_to - control.ramp_from) *
+                            ramp_progress(control.ramp_curve, t));
+  if (volume != control.volume)
+    set_volume(control, volume);
 
-  snd_mixer_selem_set_playback_volume_all(out_elem, volume);
+  if (t >= 1.0)
+    control.ramping = false;
 }
 
-void volume_mute() {
-  if (!out_elem) {
-    error("Master volume control is not initialized");
-    return;
+// Returns whether a ramp is still running afterwards.
+bool advance_ramps() {
+  MixerState previous, state;
+  bool ramping;
+  {
+    std::lock_guard<std::mutex> lock(mixer_mutex);
+    auto now = std::chrono::steady_clock::now();
+
+    previous = current_state();
+    for (Control &control : controls) {
+      advance_ramp(control, now);
+    }
+    state = current_state();
+
+    ramping = any_ramping();
   }
+  notify_mixer(state, previous);
+  return ramping;
+}
 
-  snd_mixer_selem_set_playback_switch_all(out_elem, 0);
+void apply_pending() {
+  MixerState previous, state;
+  {
+    std::lock_guard<std::mutex> lock(mixer_mutex);
+    previous = current_state();
+    for (Control &control : controls) {
+      apply_control(control);
+    }
+    state = current_state();
+  }
+  notify_mixer(state, previous);
 }
 
-void volume_unmute() {
-  if (!out_elem) {
-    error("Master volume control is not initialized");
+// Handles ALSA events and applies pending commands at most once per tick.
+// The last descriptor is the wake event, used for new commands and to stop.
+void mixer_loop(std::vector<struct pollfd> fds) {
+  using clock = std::chrono::steady_clock;
+  clock::time_point next_apply = clock::now();
+  clock::time_point next_ramp = clock::now();
+
+  auto until = [](clock::time_point deadline) {
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - clock::now());
+    return std::max<int>(wait.count(), 0);
+  };
+
+  while (true) {
+    int timeout = -1;
+    {
+      std::lock_guard<std::mutex> lock(mixer_mutex);
+      if (mixer_stopping)
+        return;
+
+      if (any_pending())
+        timeout = until(next_apply);
+      if (any_ramping()) {
+        int ramp_timeout = until(next_ramp);
+        timeout = timeout < 0 ? ramp_timeout : std::min(timeout, ramp_timeout);
+      }
+    }
+
+    if (poll(fds.data(), fds.size(), timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      error("Failed to poll mixer: " + std::string(strerror(errno)));
+      return;
+    }
+
+    if (fds.back().revents & POLLIN) {
+      uint64_t value;
+      if (read(mixer_wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        error("Failed to read mixer wake event");
+    }
+
+    MixerState previous, state;
+    bool pending, ramping;
+    {
+      std::lock_guard<std::mutex> lock(mixer_mutex);
+      previous = current_state();
+
+      // An event on a card refreshes every element configured on it.
+      for (Card &card : cards) {
+        unsigned short revents;
+        if (card.fd_count == 0 ||
+            snd_mixer_poll_descriptors_revents(card.mixer,
+                                               fds.data() + card.fd_offset,
+                                               card.fd_count, &revents) < 0 ||
+            !revents)
+          continue;
+
+        snd_mixer_handle_events(card.mixer);
+        for (Control &control : controls) {
+          if (control.card == &card)
+            read_control(control);
+        }
+      }
+
+      state = current_state();
+      pending = any_pending();
+      ramping = any_ramping();
+    }
+    notify_mixer(state, previous);
+
+    if (pending && clock::now() >= next_apply) {
+      apply_pending();
+      next_apply = clock::now() + std::chrono::milliseconds(mixer_tick_ms);
+    }
+
+    // All ramps are stepped together at a fixed rate, from their start time,
+    // so a late wakeup never makes a ramp drift.
+    if (ramping && clock::now() >= next_ramp) {
+      advance_ramps();
+      next_ramp = clock::now() + std::chrono::milliseconds(RAMP_UPDATE_MS);
+    }
+  }
+}
+
+// Collects the poll descriptors of every card followed by the wake event.
+void start_mixer_thread() {
+  std::vector<struct pollfd> fds;
+
+  for (Card &card : cards) {
+    if (!card.mixer)
+      continue;
+
+    int count = snd_mixer_poll_descriptors_count(card.mixer);
+    if (count <= 0)
+      continue;
+
+    card.fd_offset = fds.size();
+    fds.resize(card.fd_offset + count);
+    count = snd_mixer_poll_descriptors(card.mixer, fds.data() + card.fd_offset,
+                                       count);
+    card.fd_count = std::max(count, 0);
+    fds.resize(card.fd_offset + card.fd_count);
+  }
+
+  if (fds.empty())
+    return;
+
+  mixer_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (mixer_wake_fd < 0) {
+    error("Failed to create mixer wake event");
     return;
   }
+  fds.push_back({mixer_wake_fd, POLLIN, 0});
+  mixer_stopping = false;
 
-  snd_mixer_selem_set_playback_switch_all(out_elem, 1);
+  mixer_thread = std::thread(mixer_loop, std::move(fds));
 }
 
-void volume_toggle() {
-  if (!out_elem) {
-    error("Master volume control is not initialized");
-    return;
+void init_alsa() {
+  MixerState previous, state;
+  {
+    std::lock_guard<std::mutex> lock(mixer_mutex);
+    mixers_opened = true;
+    previous = current_state();
+    for (Control &control : controls) {
+      open_control(control);
+    }
+    start_mixer_thread();
+    state = current_state();
   }
+  notify_mixer(state, previous);
+}
 
-  int mute_state;
-  snd_mixer_selem_get_playback_switch(out_elem, SND_MIXER_SCHN_FRONT_LEFT,
-                                      &mute_state);
-  snd_mixer_selem_set_playback_switch_all(out_elem, !mute_state);
+void wake_mixer_thread() {
+  uint64_t value = 1;
+  if (write(mixer_wake_fd, &value, sizeof(value)) < 0)
+    error("Failed to wake mixer thread");
 }
 
-void capture_inc(int amount) {
-  if (!in_elem) {
-    error("Master capture control is not initialized");
-    return;
+void clean_alsa() {
+  {
+    std::lock_guard<std::mutex> lock(mixer_mutex);
+    mixer_stopping = true;
+    if (mixer_wake_fd >= 0)
+      wake_mixer_thread();
   }
+  if (mixer_thread.joinable())
+    mixer_thread.join();
 
-  long min, max;
-  snd_mixer_selem_get_capture_volume_range(in_elem, &min, &max);
+  std::lock_guard<std::mutex> lock(mixer_mutex);
+  if (mixer_wake_fd >= 0) {
+    close(mixer_wake_fd);
+    mixer_wake_fd = -1;
+  }
 
-  long volume;
-  snd_mixer_selem_get_capture_volume(in_elem, SND_MIXER_SCHN_FRONT_LEFT,
-                                     &volume);
+  for (Control &control : controls) {
+    control.card = nullptr;
+    control.elem = nullptr;
+  }
+  for (Card &card : cards) {
+    if (card.mixer)
+      snd_mixer_close(card.mixer);
+  }
+  cards.clear();
+}
 
-  float amount_f = std::clamp(static_cast<float>(amount) / 100.0f, 0.0f, 1.0f);
+void set_mixer_listener(MixerListener listener) {
+  std::lock_guard<std::mutex> lock(mixer_mutex);
+  mixer_listener = std::move(listener);
+}
 
-  volume += (max - min) * amount_f;
-  if (volume > max)
-    volume = max;
+void set_mixer_tick(int milliseconds) {
+  std::lock_guard<std::mutex> lock(mixer_mutex);
+  mixer_tick_ms = std::max(milliseconds, 0);
+}
 
-  snd_mixer_selem_set_capture_volume_all(in_elem, volume);
+MixerState mixer_state() {
+  std::lock_guard<std::mutex> lock(mixer_mutex);
+  return current_state();
 }
 
-void capture_dec(int amount) {
-  if (!in_elem) {
-    error("Master capture control is not initialized");
-    return;
+long range_step(const Control &control, int amount, bool round = false) {
+  float amount_f = std::clamp(static_cast<float>(amount) / 100.0f, 0.0f, 1.0f);
+  float step = (control.max - control.min) * amount_f;
+  return static_cast<long>(round ? std::round(step) : step);
+}
+
+// Records a command for the next tick. Without a mixer thread the command
+// is applied right away.
+template <typename Action> void request(uint32_t element, Action action) {
+  mixer_requested->add();
+
+  bool immediate;
+  {
+    std::lock_guard<std::mutex> lock(mixer_mutex);
+    if (element >= controls.size()) {
+      error("Unknown mixer element " + std::to_string(element));
+      return;
+    }
+
+    Control &control = controls[element];
+    if (!control.elem) {
+      error(describe(control) + " is not initialized");
+      return;
+    }
+
+    action(control);
+    control.pending = true;
+
+    immediate = mixer_wake_fd < 0;
+    if (!immediate)
+      wake_mixer_thread();
   }
 
-  long min, max;
-  snd_mixer_selem_get_capture_volume_range(in_elem, &min, &max);
+  if (immediate)
+    apply_pending();
+}
 
-  long volume;
-  snd_mixer_selem_get_capture_volume(in_elem, SND_MIXER_SCHN_FRONT_LEFT,
-                                     &volume);
+void step_volume(Control &control, long step) {
+  control.pending_delta += step;
+  control.ramping = false;
+}
 
-  float amount_f = std::clamp(static_cast<float>(amount) / 100.0f, 0.0f, 1.0f);
+void set_volume_percent(Control &control, int amount) {
+  control.ramping = false;
+  control.pending_set = true;
+  control.pending_volume = control.min + range_step(control, amount, true);
+  control.pending_delta = 0;
+}
 
-  volume -= (max - min) * amount_f;
-  if (volume > max)
-    volume = max;
+void set_switch(Control &control, int enabled) {
+  control.pending_enabled = enabled;
+  control.pending_toggle = false;
+}
 
-  snd_mixer_selem_set_capture_volume_all(in_elem, volume);
+void toggle_switch(Control &control) {
+  if (control.pending_enabled >= 0) {
+    control.pending_enabled = !control.pending_enabled;
+  } else {
+    control.pending_toggle = !control.pending_toggle;
+  }
 }
 
-void capture_set(int amount) {
-  if (!in_elem) {
-    error("Master capture control is not initialized");
+// Without a mixer thread to drive it, a ramp jumps straight to its target.
+void start_ramp(Control &control, const Ramp &ramp) {
+  if (ramp.duration == 0 || mixer_wake_fd < 0) {
+    set_volume_percent(control, ramp.target);
     return;
   }
 
-  long min, max;
-  snd_mixer_selem_get_capture_volume_range(in_elem, &min, &max);
+  control.pending_set = false;
+  control.pending_delta = 0;
 
-  float amount_f = std::clamp(static_cast<float>(amount) / 100.0f, 0.0f, 1.0f);
+  control.ramping = true;
+  control.ramp_from = control.volume;
+  control.ramp_to = control.min + range_step(control, ramp.target, true);
+  control.ramp_curve = ramp.curve;
+  control.ramp_start = std::chrono::steady_clock::now();
+  control.ramp_duration = std::chrono::milliseconds(ramp.duration);
+}
 
-  long volume = min + static_cast<long>(std::round((max - min) * amount_f));
+void mixer_inc(uint32_t element, int amount) {
+  request(element, [amount](Control &control) {
+    step_volume(control, range_step(control, amount));
+  });
+}
 
-  snd_mixer_selem_set_capture_volume_all(in_elem, volume);
+void mixer_dec(uint32_t element, int amount) {
+  request(element, [amount](Control &control) {
+    step_volume(control, -range_step(control, amount));
+  });
 }
 
-void capture_mute() {
-  if (!in_elem) {
-    error("Master capture control is not initialized");
-    return;
-  }
+void mixer_set(uint32_t element, int amount) {
+  request(element, [amount](Control &control) {
+    set_volume_percent(control, amount);
+  });
+}
 
-  snd_mixer_selem_set_capture_switch_all(in_elem, 0);
+void mixer_ramp(uint32_t element, const Ramp &ramp) {
+  request(element, [&ramp](Control &control) { start_ramp(control, ramp); });
 }
 
-void capture_unmute() {
-  if (!in_elem) {
-    error("Master capture control is not initialized");
-    return;
-  }
+void mixer_mute(uint32_t element) {
+  request(element, [](Control &control) { set_switch(control, 0); });
+}
+
+void mixer_unmute(uint32_t element) {
+  request(element, [](Control &control) { set_switch(control, 1); });
+}
 
-  snd_mixer_selem_set_capture_switch_all(in_elem, 1);
+void mixer_toggle(uint32_t element) {
+  request(element, [](Control &control) { toggle_switch(control); });
+}
+
+void volume_inc(int amount) {
+  mixer_inc(MIXER_MASTER, amount);
+}
+
+void volume_dec(int amount) {
+  mixer_dec(MIXER_MASTER, amount);
+}
+
+void volume_set(int amount) {
+  mixer_set(MIXER_MASTER, amount);
+}
+
+void volume_mute() {
+  mixer_mute(MIXER_MASTER);
+}
+
+void volume_unmute() {
+  mixer_unmute(MIXER_MASTER);
+}
+
+void volume_toggle() {
+  mixer_toggle(MIXER_MASTER);
+}
+
+void volume_ramp(const Ramp &ramp) {
+  mixer_ramp(MIXER_MASTER, ramp);
+}
+
+void capture_inc(int amount) {
+  mixer_inc(MIXER_CAPTURE, amount);
+}
+
+void capture_dec(int amount) {
+  mixer_dec(MIXER_CAPTURE, amount);
+}
+
+void capture_set(int amount) {
+  mixer_set(MIXER_CAPTURE, amount);
+}
+
+void capture_mute() {
+  mixer_mute(MIXER_CAPTURE);
+}
+
+void capture_unmute() {
+  mixer_unmute(MIXER_CAPTURE);
 }
 
 void capture_toggle() {
-  if (!in_elem) {
-    error("Master capture control is not initialized");
-    return;
-  }
+  mixer_toggle(MIXER_CAPTURE);
+}
 
-  int mute_state;
-  snd_mixer_selem_get_capture_switch(in_elem, SND_MIXER_SCHN_FRONT_LEFT,
-                                     &mute_state);
-  snd_mixer_selem_set_capture_switch_all(in_elem, !mute_state);
+void capture_ramp(const Ramp &ramp) {
+  mixer_ramp(MIXER_CAPTURE, ramp);
 }
@@ -1,14 +1,89 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Levels are in percent of the element range, muted means the switch is off.
+struct MixerState {
+  int volume = 0;
+  bool muted = false;
+  int capture = 0;
+  bool capture_muted = false;
+};
+
+// A simple mixer element on a sound card, referred to by name in macros.
+struct MixerElement {
+  std::string name;
+  std::string card;
+  std::string element;
+  unsigned index;
+  bool capture;
+};
+
+bool operator==(const MixerElement &a, const MixerElement &b);
+
+// Built-in elements, the default card's Master and Capture controls. The
+// mixer state sent to clients always describes these two.
+enum MixerId : uint32_t {
+  MIXER_MASTER,
+  MIXER_CAPTURE,
+};
+
+enum RampCurve {
+  RAMP_LINEAR,
+  RAMP_EASE_IN,
+  RAMP_EASE_OUT,
+  RAMP_EASE,
+};
+
+// Moves a level to target percent over duration milliseconds.
+struct Ramp {
+  int target;
+  uint32_t duration;
+  RampCurve curve;
+};
+
+// Called whenever the mixer state changes, by an action or by another
+// program, from whichever thread noticed the change.
+using MixerListener =
+    std::function<void(const MixerState &state, const MixerState &previous)>;
+
+// Adds or redefines elements by name. Elements can only be configured
+// before init_alsa, afterwards this returns false.
+bool configure_mixers(const std::vector<MixerElement> &elements);
+// Returns the id of an element, or -1 when there is none by that name.
+int mixer_element(const std::string &name);
+size_t mixer_element_count();
+// Changes whenever element names or ids change.
+uint64_t mixer_signature();
+
 void init_alsa();
 void clean_alsa();
 
+void set_mixer_listener(MixerListener listener);
+// Volume and capture commands are collected and applied at most once per
+// tick, a burst of steps turns into a single write.
+void set_mixer_tick(int milliseconds);
+MixerState mixer_state();
+
+void mixer_inc(uint32_t element, int amount);
+void mixer_dec(uint32_t element, int amount);
+void mixer_set(uint32_t element, int amount);
+void mixer_mute(uint32_t element);
+void mixer_unmute(uint32_t element);
+void mixer_toggle(uint32_t element);
+void mixer_ramp(uint32_t element, const Ramp &ramp);
+
 void volume_inc(int amount);
 void volume_dec(int amount);
 void volume_set(int amount);
 void volume_mute();
 void volume_unmute();
 void volume_toggle();
+void volume_ramp(const Ramp &ramp);
 
 void capture_inc(int amount);
 void capture_dec(int amount);
@@ -16,3 +91,4 @@ void capture_set(int amount);
 void capture_mute();
 void capture_unmute();
 void capture_toggle();
+void capture_ramp(const Ramp &ramp);
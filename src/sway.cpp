@@ -0,0 +1,135 @@
+#include "sway.hpp"
+#include "ipc.hpp"
+#include "log.hpp"
+#include "nlohmann/json.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+
+#define SWAY_TIMEOUT_MS 1000
+#define SWAY_MAGIC "i3-ipc"
+#define SWAY_MAGIC_SIZE 6
+#define SWAY_HEADER_SIZE (SWAY_MAGIC_SIZE + 8)
+#define SWAY_MAX_REPLY (64 * 1024 * 1024)
+
+using json = nlohmann::json;
+
+int sway_fd = -1;
+std::mutex sway_mutex;
+
+std::string sway_socket() {
+  const char *path = getenv("SWAYSOCK");
+  if (!path)
+    path = getenv("I3SOCK");
+  return path ? path : "";
+}
+
+// Messages are the magic string, payload length and type in native byte
+// order, then the payload.
+bool sway_send(int fd, uint32_t type, const std::string &payload) {
+  char header[SWAY_HEADER_SIZE];
+  uint32_t length = static_cast<uint32_t>(payload.size());
+  std::memcpy(header, SWAY_MAGIC, SWAY_MAGIC_SIZE);
+  std::memcpy(header + SWAY_MAGIC_SIZE, &length, 4);
+  std::memcpy(header + SWAY_MAGIC_SIZE + 4, &type, 4);
+
+  return write_all(fd, header, sizeof(header)) &&
+         write_all(fd, payload.data(), payload.size());
+}
+
+bool sway_receive(int fd, uint32_t &type, std::string &payload) {
+  char header[SWAY_HEADER_SIZE];
+  if (!read_exact(fd, header, sizeof(header)) ||
+      std::memcmp(header, SWAY_MAGIC, SWAY_MAGIC_SIZE) != 0)
+    return false;
+
+  uint32_t length;
+  std::memcpy(&length, header + SWAY_MAGIC_SIZE, 4);
+  std::memcpy(&type, header + SWAY_MAGIC_SIZE + 4, 4);
+  if (length > SWAY_MAX_REPLY)
+    return false;
+
+  payload.resize(length);
+  return read_exact(fd, payload.data(), length);
+}
+
+bool sway_connect() {
+  std::string path = sway_socket();
+  if (path.empty()) {
+    error("Sway is not running");
+    return false;
+  }
+
+  sway_fd = connect_unix(path, SWAY_TIMEOUT_MS);
+  if (sway_fd < 0) {
+    error("Failed to connect to sway: " + std::string(strerror(errno)));
+    return false;
+  }
+  return true;
+}
+
+void sway_disconnect() {
+  if (sway_fd >= 0) {
+    close(sway_fd);
+    sway_fd = -1;
+  }
+}
+
+bool sway_request(SwayMessage type, const std::string &payload,
+                  std::string &reply) {
+  std::lock_guard<std::mutex> lock(sway_mutex);
+
+  // A connection that was fine when last used may have been closed by a
+  // sway restart since, that is only noticed here and retried once.
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reused = sway_fd >= 0;
+    if (!reused && !sway_connect())
+      return false;
+
+    uint32_t reply_type;
+    if (sway_send(sway_fd, type, payload) &&
+        sway_receive(sway_fd, reply_type, reply) && reply_type == type)
+      return true;
+
+    sway_disconnect();
+    if (!reused)
+      break;
+  }
+
+  error("Sway request failed");
+  return false;
+}
+
+// The reply holds one result per command, all of them have to succeed.
+bool sway_command(const std::string &command) {
+  std::string reply;
+  if (!sway_request(SWAY_RUN_COMMAND, command, reply))
+    return false;
+
+  json results = json::parse(reply, nullptr, false);
+  if (!results.is_array()) {
+    error("Invalid reply to sway command: " + command);
+    return false;
+  }
+
+  for (const auto &result : results) {
+    if (!result.is_object() || !result.value("success", false)) {
+      std::string reason = "unknown error";
+      if (result.is_object() && result.contains("error") &&
+          result["error"].is_string())
+        reason = result["error"].get<std::string>();
+      warning("Sway command " + command + " failed: " + reason);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void clean_sway() {
+  std::lock_guard<std::mutex> lock(sway_mutex);
+  sway_disconnect();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// i3-ipc message types used by MacroDeck, sway speaks the same protocol.
+enum SwayMessage : uint32_t {
+  SWAY_RUN_COMMAND = 0,
+  SWAY_GET_WORKSPACES = 1,
+  SWAY_SUBSCRIBE = 2,
+  SWAY_GET_TREE = 4,
+};
+
+// Path of the sway IPC socket, empty outside sway.
+std::string sway_socket();
+
+// Sends a message over the shared connection to sway, opened on first use
+// and reopened once if sway restarted in between.
+bool sway_request(SwayMessage type, const std::string &payload,
+                  std::string &reply);
+// Runs a sway command such as "[app_id=\"foot\"] focus".
+bool sway_command(const std::string &command);
+void clean_sway();
+
+// Framing shared with other connections to the same socket.
+bool sway_send(int fd, uint32_t type, const std::string &payload);
+bool sway_receive(int fd, uint32_t &type, std::string &payload);
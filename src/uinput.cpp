@@ -0,0 +1,72 @@
+#include "uinput.hpp"
+#include "log.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+
+#define UINPUT_WRITE_TIMEOUT_MS 100
+
+bool uinput_wait_writable(int fd) {
+  struct pollfd pfd{};
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+
+  while (true) {
+    int ready = poll(&pfd, 1, UINPUT_WRITE_TIMEOUT_MS);
+    if (ready > 0)
+      return true;
+    if (ready == 0) {
+      error("Timed out waiting for uinput to accept events");
+      return false;
+    }
+    if (errno != EINTR) {
+      error(std::string("Failed to poll uinput: ") + strerror(errno));
+      return false;
+    }
+  }
+}
+
+// Hands all buffers to the kernel, continuing after short writes and
+// waiting for the device when it reports EAGAIN so no event is dropped.
+bool uinput_writev(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, iov, count);
+
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (!uinput_wait_writable(fd))
+          return false;
+        continue;
+      }
+      error(std::string("Failed to write key events: ") + strerror(errno));
+      return false;
+    }
+
+    size_t remaining = static_cast<size_t>(written);
+    while (count > 0 && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      iov++;
+      count--;
+    }
+
+    if (count > 0 && remaining > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+
+  return true;
+}
+
+bool uinput_write(int fd, const struct input_event *events, size_t count) {
+  struct iovec iov;
+  iov.iov_base = const_cast<struct input_event *>(events);
+  iov.iov_len = count * sizeof(struct input_event);
+
+  return uinput_writev(fd, &iov, 1);
+}
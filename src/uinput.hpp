@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <linux/input.h>
+#include <sys/uio.h>
+
+bool uinput_write(int fd, const struct input_event *events, size_t count);
+bool uinput_writev(int fd, struct iovec *iov, int count);
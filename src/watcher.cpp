@@ -0,0 +1,146 @@
+#include "watcher.hpp"
+#include "log.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <thread>
+#include <unistd.h>
+
+#define WATCH_MASK                                                             \
+  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE)
+
+// Editors usually touch a file several times per save, changes are collected
+// until the directory has been quiet for this long.
+#define WATCH_SETTLE_MS 100
+
+namespace fs = std::filesystem;
+
+int inotify_fd = -1;
+int stop_fd = -1;
+int config_wd = -1;
+int macros_wd = -1;
+int icons_wd = -1;
+int sounds_wd = -1;
+
+std::string config_name;
+ChangeHandler change_handler;
+std::thread watcher_thread;
+
+bool is_icon(const fs::path &path) {
+  std::string extension = path.extension().string();
+  return extension == ".png" || extension == ".jpg" || extension == ".jpeg";
+}
+
+void collect_events(const char *buffer, ssize_t length, ChangeSet &changes) {
+  for (const char *ptr = buffer; ptr < buffer + length;) {
+    const struct inotify_event *event =
+        reinterpret_cast<const struct inotify_event *>(ptr);
+    ptr += sizeof(struct inotify_event) + event->len;
+
+    if (event->len == 0)
+      continue;
+
+    fs::path path(event->name);
+    if (event->wd == config_wd && path == config_name) {
+      changes.config = true;
+    } else if (event->wd == macros_wd && path.extension() == ".json") {
+      changes.macros.insert(path.stem().string());
+    } else if (event->wd == icons_wd && is_icon(path)) {
+      changes.icons.insert(path.stem().string());
+    } else if (event->wd == sounds_wd && path.extension() == ".wav") {
+      changes.sounds.insert(path.stem().string());
+    }
+  }
+}
+
+void watcher_loop() {
+  alignas(struct inotify_event) char buffer[4096];
+  struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+
+  ChangeSet changes;
+  bool pending = false;
+
+  while (true) {
+    int ready = poll(fds, 2, pending ? WATCH_SETTLE_MS : -1);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      error(std::string("Failed to watch config: ") + strerror(errno));
+      return;
+    }
+
+    if (fds[1].revents & POLLIN)
+      return;
+
+    if (ready == 0) {
+      if (changes.config || !changes.macros.empty() ||
+          !changes.icons.empty() || !changes.sounds.empty())
+        change_handler(changes);
+      changes = ChangeSet();
+      pending = false;
+      continue;
+    }
+
+    ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+    if (length > 0) {
+      collect_events(buffer, length, changes);
+      pending = true;
+    }
+  }
+}
+
+int add_watch(const fs::path &path) {
+  int wd = inotify_add_watch(inotify_fd, path.c_str(), WATCH_MASK);
+  if (wd < 0) {
+    warning("Failed to watch " + path.string() + ": " + strerror(errno));
+  }
+  return wd;
+}
+
+bool init_watcher(const std::string &config_path, const std::string &dir,
+                  const ChangeHandler &handler) {
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (inotify_fd < 0 || stop_fd < 0) {
+    error(std::string("Failed to initialize inotify: ") + strerror(errno));
+    clean_watcher();
+    return false;
+  }
+
+  fs::path config(config_path);
+  config_name = config.filename().string();
+  change_handler = handler;
+
+  // Directories are watched instead of files so that editors replacing a
+  // file with a renamed copy are still noticed.
+  config_wd = add_watch(config.has_parent_path() ? config.parent_path() : ".");
+  macros_wd = add_watch(fs::path(dir) / "macros");
+  icons_wd = add_watch(fs::path(dir) / "icons");
+  sounds_wd = add_watch(fs::path(dir) / "sounds");
+
+  watcher_thread = std::thread(watcher_loop);
+  return true;
+}
+
+void clean_watcher() {
+  if (watcher_thread.joinable()) {
+    uint64_t value = 1;
+    if (write(stop_fd, &value, sizeof(value)) == sizeof(value))
+      watcher_thread.join();
+    else
+      watcher_thread.detach();
+  }
+
+  if (inotify_fd >= 0) {
+    close(inotify_fd);
+    inotify_fd = -1;
+  }
+  if (stop_fd >= 0) {
+    close(stop_fd);
+    stop_fd = -1;
+  }
+}
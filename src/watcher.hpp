@@ -0,0 +1,20 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_set>
+
+// Files that changed since the last notification, macros, icons and sounds
+// by name.
+struct ChangeSet {
+  bool config = false;
+  std::unordered_set<std::string> macros;
+  std::unordered_set<std::string> icons;
+  std::unordered_set<std::string> sounds;
+};
+
+using ChangeHandler = std::function<void(const ChangeSet &)>;
+
+bool init_watcher(const std::string &config_path, const std::string &dir,
+                  const ChangeHandler &handler);
+void clean_watcher();
@@ -0,0 +1,719 @@
+#include "windows.hpp"
+#include "hyprland.hpp"
+#include "ipc.hpp"
+#include "log.hpp"
+#include "nlohmann/json.hpp"
+#include "sway.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef HAVE_X11
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#endif
+
+#define WINDOWS_TIMEOUT_MS 1000
+#define WINDOWS_RETRY_MS 2000
+#define SWAY_EVENT_WINDOW 0x80000003u
+
+using json = nlohmann::json;
+
+struct WindowEntry {
+  AppWindow window;
+  std::string key;
+  uint64_t focused_at = 0;
+  // Event serials of the last time the window opened or gained focus, and
+  // of its last title change.
+  uint64_t appeared_at = 0;
+  uint64_t titled_at = 0;
+};
+
+// Windows by id, and the ids of every app under its lowercased name so an
+// exact lookup is a single hash.
+std::unordered_map<std::string, WindowEntry> windows;
+std::unordered_map<std::string, std::unordered_set<std::string>> app_windows;
+std::string focused_id;
+uint64_t focus_serial = 0;
+uint64_t event_serial = 0;
+WindowBackend synced_backend = WINDOWS_NONE;
+std::mutex windows_mutex;
+std::condition_variable windows_cv;
+
+int windows_stop_fd = -1;
+std::thread windows_thread;
+
+std::string lowercase(std::string str) {
+  std::transform(str.begin(), str.end(), str.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return str;
+}
+
+void unindex_window(const WindowEntry &entry) {
+  auto it = app_windows.find(entry.key);
+  if (it == app_windows.end())
+    return;
+
+  it->second.erase(entry.window.id);
+  if (it->second.empty())
+    app_windows.erase(it);
+}
+
+void add_window(const AppWindow &window) {
+  WindowEntry &entry = windows[window.id];
+  if (!entry.window.id.empty())
+    unindex_window(entry);
+
+  entry.window = window;
+  entry.key = lowercase(window.app);
+  app_windows[entry.key].insert(window.id);
+}
+
+void reset_windows(WindowBackend backend, const std::vector<AppWindow> &list,
+                   const std::string &focused) {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  // Resyncing the same backend, as X11 does on every client list change,
+  // turns the differences into events. A first sync has none.
+  bool incremental = backend != WINDOWS_NONE && backend == synced_backend;
+  std::unordered_map<std::string, WindowEntry> previous;
+  previous.swap(windows);
+  app_windows.clear();
+
+  for (const AppWindow &window : list) {
+    add_window(window);
+    WindowEntry &entry = windows[window.id];
+    entry.focused_at = ++focus_serial;
+    if (!incremental)
+      continue;
+
+    auto old = previous.find(window.id);
+    if (old == previous.end()) {
+      entry.appeared_at = ++event_serial;
+      continue;
+    }
+    entry.appeared_at = old->second.appeared_at;
+    entry.titled_at = old->second.window.title == window.title
+                          ? old->second.titled_at
+                          : ++event_serial;
+  }
+
+  auto it = windows.find(focused);
+  if (it != windows.end()) {
+    it->second.focused_at = ++focus_serial;
+    if (incremental && focused != focused_id)
+      it->second.appeared_at = ++event_serial;
+  }
+
+  focused_id = focused;
+  synced_backend = backend;
+  windows_cv.notify_all();
+}
+
+void window_opened(const AppWindow &window) {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  add_window(window);
+  windows[window.id].appeared_at = ++event_serial;
+  windows_cv.notify_all();
+}
+
+void window_closed(const std::string &id) {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  auto it = windows.find(id);
+  if (it == windows.end())
+    return;
+
+  unindex_window(it->second);
+  windows.erase(it);
+  if (focused_id == id)
+    focused_id.clear();
+}
+
+void window_focused(const std::string &id) {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  focused_id = id;
+  auto it = windows.find(id);
+  if (it == windows.end())
+    return;
+
+  it->second.focused_at = ++focus_serial;
+  it->second.appeared_at = ++event_serial;
+  windows_cv.notify_all();
+}
+
+void window_titled(const std::string &id, const std::string &title) {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  auto it = windows.find(id);
+  if (it == windows.end())
+    return;
+
+  it->second.window.title = title;
+  it->second.titled_at = ++event_serial;
+  windows_cv.notify_all();
+}
+
+WindowBackend window_backend() {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  return synced_backend;
+}
+
+bool find_window(const std::string &query, AppWindow &window) {
+  std::string key = lowercase(query);
+  std::lock_guard<std::mutex> lock(windows_mutex);
+
+  const WindowEntry *best = nullptr;
+  auto consider = [&](const std::unordered_set<std::string> &ids) {
+    for (const auto &id : ids) {
+      const WindowEntry &entry = windows.at(id);
+      if (!best || entry.focused_at > best->focused_at)
+        best = &entry;
+    }
+  };
+
+  auto it = app_windows.find(key);
+  if (it != app_windows.end()) {
+    consider(it->second);
+  } else {
+    for (const auto &[app, ids] : app_windows) {
+      if (app.compare(0, key.size(), key) == 0)
+        consider(ids);
+    }
+    if (!best) {
+      for (const auto &[app, ids] : app_windows) {
+        if (app.find(key) != std::string::npos)
+          consider(ids);
+      }
+    }
+  }
+
+  if (!best)
+    return false;
+
+  window = best->window;
+  return true;
+}
+
+bool window_matches(const AppWindow &window, const std::string &app,
+                    const std::string &title) {
+  return lowercase(window.app).find(lowercase(app)) != std::string::npos &&
+         lowercase(window.title).find(lowercase(title)) != std::string::npos;
+}
+
+uint64_t window_events() {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  return event_serial;
+}
+
+bool wait_for_window(const std::string &app, const std::string &title,
+                     uint64_t since, uint32_t timeout_ms) {
+  bool found = false;
+  auto done = [&] {
+    // Unsynced, either stopped or lost, no more events will come.
+    if (synced_backend == WINDOWS_NONE)
+      return true;
+
+    for (const auto &[id, entry] : windows) {
+      bool changed = entry.appeared_at > since ||
+                     (!title.empty() && entry.titled_at > since);
+      if (changed && window_matches(entry.window, app, title)) {
+        found = true;
+        return true;
+      }
+    }
+    return false;
+  };
+
+  std::unique_lock<std::mutex> lock(windows_mutex);
+  windows_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+  return found;
+}
+
+bool focused_window(AppWindow &window) {
+  std::lock_guard<std::mutex> lock(windows_mutex);
+  auto it = windows.find(focused_id);
+  if (it == windows.end())
+    return false;
+
+  window = it->second.window;
+  return true;
+}
+
+// Returns true once clean_windows asked the thread to stop, waiting up to
+// timeout_ms for it.
+bool wait_stop(int timeout_ms) {
+  struct pollfd fd = {windows_stop_fd, POLLIN, 0};
+  return poll(&fd, 1, timeout_ms) > 0;
+}
+
+// Waits for data on fd, returns false when stopping.
+bool wait_readable(int fd) {
+  struct pollfd fds[2] = {{fd, POLLIN, 0}, {windows_stop_fd, POLLIN, 0}};
+  while (poll(fds, 2, -1) < 0) {
+    if (errno != EINTR)
+      return false;
+  }
+  return !(fds[1].revents & POLLIN);
+}
+
+std::string hyprland_id(const std::string &address) {
+  return address.compare(0, 2, "0x") == 0 ? address.substr(2) : address;
+}
+
+void hyprland_sync() {
+  std::vector<HyprlandWindow> clients = hyprland_clients();
+
+  // Higher focus history ids were focused longer ago.
+  std::sort(clients.begin(), clients.end(),
+            [](const HyprlandWindow &a, const HyprlandWindow &b) {
+              return a.focus_history > b.focus_history;
+            });
+
+  std::vector<AppWindow> list;
+  std::string focused;
+  for (const HyprlandWindow &client : clients) {
+    list.push_back({hyprland_id(client.address), client.class_name,
+                    client.title});
+    if (client.focus_history == 0)
+      focused = list.back().id;
+  }
+
+  reset_windows(WINDOWS_HYPRLAND, list, focused);
+}
+
+// Events are lines of the form name>>data, with comma separated fields.
+void hyprland_event(const std::string &line) {
+  size_t separator = line.find(">>");
+  if (separator == std::string::npos)
+    return;
+
+  std::string name = line.substr(0, separator);
+  std::string data = line.substr(separator + 2);
+
+  if (name == "openwindow") {
+    // address,workspace,class,title where the title may contain commas.
+    size_t first = data.find(',');
+    if (first == std::string::npos)
+      return;
+    size_t second = data.find(',', first + 1);
+    if (second == std::string::npos)
+      return;
+    size_t third = data.find(',', second + 1);
+    if (third == std::string::npos)
+      return;
+
+    window_opened({data.substr(0, first),
+                   data.substr(second + 1, third - second - 1),
+                   data.substr(third + 1)});
+  } else if (name == "closewindow") {
+    window_closed(data);
+  } else if (name == "activewindowv2") {
+    window_focused(data == "," ? "" : data);
+  } else if (name == "windowtitlev2") {
+    size_t comma = data.find(',');
+    if (comma != std::string::npos)
+      window_titled(data.substr(0, comma), data.substr(comma + 1));
+  }
+}
+
+// Returns true when stopping, false when the connection was lost.
+bool watch_hyprland() {
+  int fd = connect_unix(hyprland_socket(".socket2.sock"), WINDOWS_TIMEOUT_MS);
+  if (fd < 0) {
+    warning("Failed to connect to Hyprland events: " +
+            std::string(strerror(errno)));
+    return false;
+  }
+
+  // Connected before syncing, so events in between are applied after it.
+  hyprland_sync();
+
+  std::string buffer;
+  char chunk[4096];
+  while (wait_readable(fd)) {
+    ssize_t length = read(fd, chunk, sizeof(chunk));
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length <= 0) {
+      close(fd);
+      return false;
+    }
+
+    buffer.append(chunk, length);
+    size_t start = 0;
+    for (size_t end; (end = buffer.find('\n', start)) != std::string::npos;
+         start = end + 1) {
+      hyprland_event(buffer.substr(start, end - start));
+    }
+    buffer.erase(0, start);
+  }
+
+  close(fd);
+  return true;
+}
+
+bool sway_window(const json &node, AppWindow &window) {
+  if (!node.contains("id") || !node["id"].is_number_integer())
+    return false;
+
+  if (node.contains("app_id") && node["app_id"].is_string()) {
+    window.app = node["app_id"].get<std::string>();
+  } else if (node.contains("window_properties") &&
+             node["window_properties"].is_object() &&
+             node["window_properties"].contains("class") &&
+             node["window_properties"]["class"].is_string()) {
+    window.app = node["window_properties"]["class"].get<std::string>();
+  } else {
+    return false;
+  }
+
+  window.id = std::to_string(node["id"].get<int64_t>());
+  window.title = node.contains("name") && node["name"].is_string()
+                     ? node["name"].get<std::string>()
+                     : "";
+  return true;
+}
+
+void sway_walk(const json &node, std::vector<AppWindow> &list,
+               std::string &focused) {
+  AppWindow window;
+  if (sway_window(node, window)) {
+    if (node.value("focused", false))
+      focused = window.id;
+    list.push_back(std::move(window));
+  }
+
+  for (const char *children : {"nodes", "floating_nodes"}) {
+    if (!node.contains(children) || !node[children].is_array())
+      continue;
+    for (const auto &child : node[children]) {
+      sway_walk(child, list, focused);
+    }
+  }
+}
+
+void sway_event(const std::string &payload) {
+  json event = json::parse(payload, nullptr, false);
+  if (!event.is_object() || !event.contains("container"))
+    return;
+
+  std::string change = event.value("change", "");
+  AppWindow window;
+  if (!sway_window(event["container"], window))
+    return;
+
+  // Other changes, such as move or urgent, say nothing about readiness.
+  if (change == "new") {
+    window_opened(window);
+  } else if (change == "close") {
+    window_closed(window.id);
+  } else if (change == "focus") {
+    window_focused(window.id);
+  } else if (change == "title") {
+    window_titled(window.id, window.title);
+  }
+}
+
+bool watch_sway() {
+  int fd = connect_unix(sway_socket(), WINDOWS_TIMEOUT_MS);
+  if (fd < 0) {
+    warning("Failed to connect to sway events: " +
+            std::string(strerror(errno)));
+    return false;
+  }
+
+  uint32_t type;
+  std::string reply;
+  if (!sway_send(fd, SWAY_SUBSCRIBE, "[\"window\"]") ||
+      !sway_receive(fd, type, reply) || type != SWAY_SUBSCRIBE ||
+      !json::parse(reply, nullptr, false).value("success", false)) {
+    warning("Failed to subscribe to sway window events");
+    close(fd);
+    return false;
+  }
+
+  // The tree is fetched over the command connection, the subscribed one
+  // only carries events from here on.
+  std::vector<AppWindow> list;
+  std::string focused;
+  if (sway_request(SWAY_GET_TREE, "", reply))
+    sway_walk(json::parse(reply, nullptr, false), list, focused);
+  reset_windows(WINDOWS_SWAY, list, focused);
+
+  while (wait_readable(fd)) {
+    if (!sway_receive(fd, type, reply)) {
+      close(fd);
+      return false;
+    }
+    if (type == SWAY_EVENT_WINDOW)
+      sway_event(reply);
+  }
+
+  close(fd);
+  return true;
+}
+
+#ifdef HAVE_X11
+Display *x11_display = nullptr;
+std::mutex x11_mutex;
+Atom net_client_list;
+Atom net_active_window;
+Atom net_wm_name;
+Atom utf8_string;
+
+// Windows may disappear while they are being looked at, the default handler
+// would exit the process.
+int ignore_x11_error(Display *, XErrorEvent *) {
+  return 0;
+}
+
+std::vector<::Window> x11_window_list(::Window window, Atom property) {
+  std::vector<::Window> list;
+
+  Atom type;
+  int format;
+  unsigned long count, after;
+  unsigned char *data = nullptr;
+  if (XGetWindowProperty(x11_display, window, property, 0, 4096, False,
+                         XA_WINDOW, &type, &format, &count, &after,
+                         &data) == Success &&
+      data) {
+    if (type == XA_WINDOW && format == 32) {
+      ::Window *windows = reinterpret_cast<::Window *>(data);
+      list.assign(windows, windows + count);
+    }
+    XFree(data);
+  }
+
+  return list;
+}
+
+// Prefers the UTF-8 _NET_WM_NAME over the legacy WM_NAME.
+std::string x11_title(::Window id) {
+  std::string title;
+
+  Atom type;
+  int format;
+  unsigned long count, after;
+  unsigned char *data = nullptr;
+  if (XGetWindowProperty(x11_display, id, net_wm_name, 0, 1024, False,
+                         utf8_string, &type, &format, &count, &after,
+                         &data) == Success &&
+      data) {
+    title.assign(reinterpret_cast<char *>(data), count);
+    XFree(data);
+    return title;
+  }
+
+  char *name = nullptr;
+  if (XFetchName(x11_display, id, &name) && name) {
+    title = name;
+    XFree(name);
+  }
+  return title;
+}
+
+AppWindow x11_window(::Window id) {
+  AppWindow window;
+  window.id = std::to_string(id);
+
+  XClassHint hint;
+  if (XGetClassHint(x11_display, id, &hint)) {
+    if (hint.res_class)
+      window.app = hint.res_class;
+    XFree(hint.res_name);
+    XFree(hint.res_class);
+  }
+
+  window.title = x11_title(id);
+  return window;
+}
+
+std::string x11_active() {
+  std::vector<::Window> active =
+      x11_window_list(DefaultRootWindow(x11_display), net_active_window);
+  return active.empty() || active[0] == 0 ? "" : std::to_string(active[0]);
+}
+
+// Every client is watched for property changes, so renames are seen as
+// they happen. Selecting again for known clients is harmless.
+void x11_sync() {
+  std::vector<AppWindow> list;
+  for (::Window id :
+       x11_window_list(DefaultRootWindow(x11_display), net_client_list)) {
+    XSelectInput(x11_display, id, PropertyChangeMask);
+    list.push_back(x11_window(id));
+  }
+  reset_windows(WINDOWS_X11, list, x11_active());
+}
+
+bool watch_x11() {
+  {
+    std::lock_guard<std::mutex> lock(x11_mutex);
+    x11_display = XOpenDisplay(nullptr);
+    if (!x11_display) {
+      warning("Failed to open X11 display");
+      return false;
+    }
+
+    XSetErrorHandler(ignore_x11_error);
+    net_client_list = XInternAtom(x11_display, "_NET_CLIENT_LIST", False);
+    net_active_window = XInternAtom(x11_display, "_NET_ACTIVE_WINDOW", False);
+    net_wm_name = XInternAtom(x11_display, "_NET_WM_NAME", False);
+    utf8_string = XInternAtom(x11_display, "UTF8_STRING", False);
+    XSelectInput(x11_display, DefaultRootWindow(x11_display),
+                 PropertyChangeMask);
+  }
+
+  x11_sync();
+
+  while (wait_readable(ConnectionNumber(x11_display))) {
+    while (XPending(x11_display)) {
+      XEvent event;
+      XNextEvent(x11_display, &event);
+      if (event.type != PropertyNotify)
+        continue;
+
+      const XPropertyEvent &property = event.xproperty;
+      if (property.window != DefaultRootWindow(x11_display)) {
+        if (property.atom == net_wm_name || property.atom == XA_WM_NAME)
+          window_titled(std::to_string(property.window),
+                        x11_title(property.window));
+      } else if (property.atom == net_client_list) {
+        x11_sync();
+      } else if (property.atom == net_active_window) {
+        window_focused(x11_active());
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(x11_mutex);
+  XCloseDisplay(x11_display);
+  x11_display = nullptr;
+  return true;
+}
+
+// Asks the window manager to activate the window, as a pager would.
+bool x11_activate(const std::string &id) {
+  std::lock_guard<std::mutex> lock(x11_mutex);
+  if (!x11_display)
+    return false;
+
+  XEvent event;
+  std::memset(&event, 0, sizeof(event));
+  event.xclient.type = ClientMessage;
+  event.xclient.window = std::stoul(id);
+  event.xclient.message_type = net_active_window;
+  event.xclient.format = 32;
+  event.xclient.data.l[0] = 2;
+  event.xclient.data.l[1] = CurrentTime;
+
+  XSendEvent(x11_display, DefaultRootWindow(x11_display), False,
+             SubstructureRedirectMask | SubstructureNotifyMask, &event);
+  XFlush(x11_display);
+  return true;
+}
+#endif
+
+bool focus_window(const AppWindow &window) {
+  switch (window_backend()) {
+  case WINDOWS_HYPRLAND:
+    return hyprland_dispatch("focuswindow address:0x" + window.id);
+  case WINDOWS_SWAY:
+    return sway_command("[con_id=" + window.id + "] focus");
+#ifdef HAVE_X11
+  case WINDOWS_X11:
+    return x11_activate(window.id);
+#endif
+  default:
+    return false;
+  }
+}
+
+WindowBackend detect_backend() {
+  if (getenv("HYPRLAND_INSTANCE_SIGNATURE"))
+    return WINDOWS_HYPRLAND;
+  if (!sway_socket().empty())
+    return WINDOWS_SWAY;
+#ifdef HAVE_X11
+  if (getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY"))
+    return WINDOWS_X11;
+#endif
+  return WINDOWS_NONE;
+}
+
+// Reconnects after the compositor went away, e.g. on a restart. The
+// registry is empty and marked unsynced until then.
+void windows_loop(WindowBackend backend) {
+  while (true) {
+    bool stopping = false;
+    switch (backend) {
+    case WINDOWS_HYPRLAND:
+      stopping = watch_hyprland();
+      break;
+    case WINDOWS_SWAY:
+      stopping = watch_sway();
+      break;
+#ifdef HAVE_X11
+    case WINDOWS_X11:
+      stopping = watch_x11();
+      break;
+#endif
+    default:
+      return;
+    }
+
+    reset_windows(WINDOWS_NONE, {}, "");
+    if (stopping || wait_stop(WINDOWS_RETRY_MS))
+      return;
+  }
+}
+
+void init_windows() {
+  WindowBackend backend = detect_backend();
+  if (backend == WINDOWS_NONE) {
+    info("No supported compositor found, window registry disabled");
+    return;
+  }
+
+#ifdef HAVE_X11
+  if (backend == WINDOWS_X11)
+    XInitThreads();
+#endif
+
+  windows_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (windows_stop_fd < 0) {
+    error(std::string("Failed to start window registry: ") + strerror(errno));
+    return;
+  }
+
+  windows_thread = std::thread(windows_loop, backend);
+}
+
+void clean_windows() {
+  if (windows_thread.joinable()) {
+    uint64_t value = 1;
+    if (write(windows_stop_fd, &value, sizeof(value)) == sizeof(value))
+      windows_thread.join();
+    else
+      windows_thread.detach();
+  }
+
+  if (windows_stop_fd >= 0) {
+    close(windows_stop_fd);
+    windows_stop_fd = -1;
+  }
+  reset_windows(WINDOWS_NONE, {}, "");
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum WindowBackend {
+  WINDOWS_NONE,
+  WINDOWS_HYPRLAND,
+  WINDOWS_SWAY,
+  WINDOWS_X11,
+};
+
+// A toplevel window as reported by the compositor. The id is the Hyprland
+// address without 0x, the sway container id or the X11 window id, app is
+// the class or app_id.
+struct AppWindow {
+  std::string id;
+  std::string app;
+  std::string title;
+};
+
+// Keeps the registry current from compositor events on a background thread,
+// picking Hyprland, sway or X11 from the environment.
+void init_windows();
+void clean_windows();
+
+// The backend the registry is currently synced with, WINDOWS_NONE while it
+// is not, in which case lookups should fall back to asking the compositor.
+WindowBackend window_backend();
+// Finds the most recently focused window whose app matches query exactly,
+// by prefix or by substring, in that order, ignoring case.
+bool find_window(const std::string &query, AppWindow &window);
+bool focused_window(AppWindow &window);
+// Asks the compositor to focus a window from the registry.
+bool focus_window(const AppWindow &window);
+
+// Whether the window's app and title contain app and title, ignoring case.
+bool window_matches(const AppWindow &window, const std::string &app,
+                    const std::string &title);
+// The current position in the stream of window events, for wait_for_window.
+uint64_t window_events();
+// Blocks until a matching window opens, gains focus or, when a title is
+// given, changes its title after the position since. Returns false once
+// timeout_ms passed without one, or as soon as the registry is unsynced by
+// clean_windows or a lost compositor connection.
+bool wait_for_window(const std::string &app, const std::string &title,
+                     uint64_t since, uint32_t timeout_ms);
+
+// Registry updates, made by the backends. They can also be fed directly,
+// e.g. from a mock event source. A reset list goes from the least to the
+// most recently focused window.
+void reset_windows(WindowBackend backend, const std::vector<AppWindow> &list,
+                   const std::string &focused);
+void window_opened(const AppWindow &window);
+void window_closed(const std::string &id);
+void window_focused(const std::string &id);
+void window_titled(const std::string &id, const std::string &title);
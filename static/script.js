@@ -1,5 +1,10 @@
 const host = window.location.host;
 const socket = new WebSocket(`ws://${host}/ws`);
+socket.binaryType = "arraybuffer";
+
+// Opcodes of the binary command protocol, see src/protocol.hpp.
+const CMD_RUN_MACRO = 1;
+const CMD_REQUEST_FLAG = 0x80;
 
 var authenticated = false;
 
@@ -7,6 +12,14 @@ var original_config = null;
 var current_confg = null;
 
 const cooldowns = {};
+const pendingRuns = new Map();
+const mixerState = {
+  volume: 0,
+  mute: false,
+  capture: 0,
+  "capture-mute": false,
+};
+var nextRequest = 1;
 
 socket.addEventListener("message", (event) => {
   const message = event.data;
@@ -15,19 +28,51 @@ socket.addEventListener("message", (event) => {
     authenticate();
   } else if (message === "auth-not-required" || message === "auth-success") {
     authenticate = true;
-    safeSend("get-config");
-  } else if (message.startsWith("config:")) {
+    requestConfig();
+  } else if (message === "warming") {
+    console.log("MacroDeck is still starting up");
+    pendingRuns.forEach(releaseButton);
+    pendingRuns.clear();
+  } else if (message === "reload:config") {
+    requestConfig();
+  } else if (message.startsWith("reload:icon:")) {
+    // Icon URLs carry the content hash, so a fresh config is all it takes.
+    requestConfig();
+  } else if (message === "config-unchanged") {
+    const cached = localStorage.getItem("config");
+    if (cached !== null) {
+      applyConfig(cached);
+    } else {
+      safeSend("get-config");
+    }
+  } else if (message.startsWith("config-v:")) {
+    const separator = message.indexOf(":", 9);
+    const text = message.slice(separator + 1);
+
     try {
-      original_config = JSON.parse(message.slice(7));
+      localStorage.setItem("config-version", message.slice(9, separator));
+      localStorage.setItem("config", text);
+    } catch (error) {
+      console.error("Failed to cache config:", error);
+    }
 
-      if (Array.isArray(original_config)) {
-        pickConfig();
-      } else {
-        current_confg = original_config;
-        createGrid();
-      }
+    applyConfig(text);
+  } else if (message.startsWith("config:")) {
+    applyConfig(message.slice(7));
+  } else if (message.startsWith("mixer:")) {
+    const separator = message.lastIndexOf(":");
+    const field = message.slice(6, separator);
+    const value = message.slice(separator + 1);
+
+    if (field in mixerState) {
+      mixerState[field] = field.endsWith("mute") ? value === "1" : Number(value);
+      updateMixerButtons();
+    }
+  } else if (message.startsWith("event:")) {
+    try {
+      handleRunEvent(JSON.parse(message.slice(6)));
     } catch (error) {
-      console.error("Failed to parse JSON:", error);
+      console.error("Failed to parse event:", error);
     }
   }
 });
@@ -42,6 +87,7 @@ socket.addEventListener("close", () => {
   authenticated = false;
   original_config = null;
   current_confg = null;
+  pendingRuns.clear();
 });
 
 function safeSend(message) {
@@ -52,6 +98,42 @@ function safeSend(message) {
   }
 }
 
+// The cached version lets the server skip sending an unchanged config.
+function requestConfig() {
+  const version = localStorage.getItem("config-version");
+  if (version !== null && localStorage.getItem("config") !== null) {
+    safeSend(`get-config:${version}`);
+  } else {
+    safeSend("get-config:");
+  }
+}
+
+function applyConfig(text) {
+  try {
+    const previous = current_confg;
+    original_config = JSON.parse(text);
+
+    if (Array.isArray(original_config)) {
+      current_confg = null;
+      if (previous !== null && "name" in previous) {
+        current_confg =
+          original_config.find((obj) => obj.name === previous.name) || null;
+      }
+
+      if (current_confg !== null) {
+        createGrid();
+      } else {
+        pickConfig();
+      }
+    } else {
+      current_confg = original_config;
+      createGrid();
+    }
+  } catch (error) {
+    console.error("Failed to parse JSON:", error);
+  }
+}
+
 function removeElements() {
   let element = null;
 
@@ -218,19 +300,25 @@ function createGrid() {
     button.classList.add("grid-button");
     button.setAttribute("data-id", `button-${i}`);
     button.setAttribute("data-macro", btn.macro);
+    if (typeof btn.id === "number") {
+      button.setAttribute("data-macro-id", btn.id);
+    }
 
     button.style.padding = "0";
 
-    const req = new XMLHttpRequest();
-    req.open("HEAD", `/icon/${btn.macro}`, false);
-    req.send();
-
     const icon =
-      req.status >= 200 && req.status < 300 ? `/icon/${btn.macro}` : null;
+      "icon" in btn && typeof btn.icon === "object" && btn.icon !== null
+        ? btn.icon
+        : null;
 
     if (icon !== null) {
       const img = document.createElement("img");
-      img.src = icon;
+      img.src = icon.url;
+      img.decoding = "async";
+      if (icon.width > 0 && icon.height > 0) {
+        img.width = icon.width;
+        img.height = icon.height;
+      }
 
       if (
         "img-width" in btn &&
@@ -275,6 +363,14 @@ function createGrid() {
       }
     }
 
+    if (btn.mixer === "volume" || btn.mixer === "capture") {
+      button.setAttribute("data-mixer", btn.mixer);
+
+      const level = document.createElement("div");
+      level.classList.add("mixer-level");
+      button.appendChild(level);
+    }
+
     let fg = "#ffffff";
     let bg = "#007bff";
     let radius = "25%";
@@ -335,6 +431,17 @@ function createGrid() {
   }
 
   document.body.appendChild(container);
+  updateMixerButtons();
+}
+
+function updateMixerButtons() {
+  document.querySelectorAll(".grid-button[data-mixer]").forEach((button) => {
+    const kind = button.getAttribute("data-mixer");
+    const muted = mixerState[kind === "volume" ? "mute" : "capture-mute"];
+
+    button.querySelector(".mixer-level").style.height = `${mixerState[kind]}%`;
+    button.classList.toggle("muted", muted);
+  });
 }
 
 function handleButtonClick(event) {
@@ -351,12 +458,80 @@ function handleButtonClick(event) {
   button.disabled = true;
   cooldowns[buttonId] = true;
 
-  safeSend(`run-macro:${macro}`);
+  // The button is released once the server has queued the run, progress is
+  // reported through the events of the request.
+  const request = nextRequest++;
+  pendingRuns.set(request, {
+    button,
+    buttonId,
+    macro,
+    sent: performance.now(),
+    times: {},
+  });
+
+  const id = button.getAttribute("data-macro-id");
+  if (id !== null) {
+    safeSend(encodeCommand(CMD_RUN_MACRO, Number(id), request));
+  } else {
+    safeSend(`req:${request}:run-macro:${macro}`);
+  }
+}
+
+function releaseButton(run) {
+  run.button.disabled = false;
+  cooldowns[run.buttonId] = false;
+}
 
-  setTimeout(() => {
-    button.disabled = false;
-    cooldowns[buttonId] = false;
-  }, 100);
+// Event times are server side microseconds, so queueing and run time can be
+// told apart from the network round trip.
+function handleRunEvent(event) {
+  const run = pendingRuns.get(event.request);
+  if (run === undefined) {
+    return;
+  }
+
+  run.times[event.state] = event.time;
+
+  if (event.state === "accepted") {
+    releaseButton(run);
+  } else if (event.state === "started") {
+    run.button.classList.add("running");
+  } else if (event.state === "finished" || event.state === "failed") {
+    releaseButton(run);
+    run.button.classList.remove("running");
+    pendingRuns.delete(event.request);
+
+    if (event.state === "failed") {
+      console.error(`Macro ${run.macro} failed: ${event.error || "unknown"}`);
+    }
+
+    const total = Math.round(performance.now() - run.sent);
+    const { accepted, started } = run.times;
+    if (accepted !== undefined && started !== undefined) {
+      const queued = (started - accepted) / 1000;
+      const ran = (event.time - started) / 1000;
+      console.debug(
+        `Macro ${run.macro}: ${total} ms total, ${queued} ms queued, ${ran} ms running`,
+      );
+    }
+  }
+}
+
+function encodeVarint(bytes, value) {
+  while (value >= 0x80) {
+    bytes.push((value & 0x7f) | 0x80);
+    value = Math.floor(value / 128);
+  }
+  bytes.push(value);
+}
+
+function encodeCommand(op, operand, request) {
+  const bytes = [request === undefined ? op : op | CMD_REQUEST_FLAG];
+  encodeVarint(bytes, operand);
+  if (request !== undefined) {
+    encodeVarint(bytes, request);
+  }
+  return new Uint8Array(bytes);
 }
 
 function displayError(message) {
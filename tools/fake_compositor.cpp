@@ -0,0 +1,81 @@
+// Serves fake Hyprland or sway sockets so MacroDeck can run without a
+// session, replaying window events read from stdin:
+//
+//   fake_compositor hyprland <runtime dir> [clients.json]
+//   fake_compositor sway <socket> [tree.json]
+//
+// Hyprland lines are sent as they are, e.g. "openwindow>>55c3,1,foot,~".
+// Sway lines are window event payloads, e.g.
+// {"change":"new","container":{"id":7,"app_id":"foot","name":"~"}}.
+// MacroDeck must be started with the environment printed at startup.
+
+#include "fake_ipc.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#define SWAY_EVENT_WINDOW 0x80000003u
+
+bool read_file(const char *path, std::string &data) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    fprintf(stderr, "Failed to read %s\n", path);
+    return false;
+  }
+
+  data.assign(std::istreambuf_iterator<char>(file),
+              std::istreambuf_iterator<char>());
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 4 ||
+      (strcmp(argv[1], "hyprland") != 0 && strcmp(argv[1], "sway") != 0)) {
+    fprintf(stderr,
+            "usage: %s hyprland <runtime dir> [clients.json]\n"
+            "       %s sway <socket> [tree.json]\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+
+  bool hyprland = strcmp(argv[1], "hyprland") == 0;
+  std::string state = hyprland ? "[]" : "{}";
+  if (argc == 4 && !read_file(argv[3], state))
+    return 1;
+
+  if (hyprland) {
+    if (!init_fake_hyprland(argv[2], "fake", state))
+      return 1;
+    printf("export XDG_RUNTIME_DIR=%s HYPRLAND_INSTANCE_SIGNATURE=fake\n",
+           argv[2]);
+  } else {
+    if (!init_fake_sway(argv[2], state))
+      return 1;
+    printf("export SWAYSOCK=%s\n", argv[2]);
+  }
+  fflush(stdout);
+
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (line.empty())
+      continue;
+    if (hyprland) {
+      fake_hyprland_event(line);
+    } else {
+      fake_sway_event(SWAY_EVENT_WINDOW, line);
+    }
+  }
+
+  if (hyprland) {
+    printf("%zu dispatches\n", fake_hyprland_dispatches());
+    clean_fake_hyprland();
+  } else {
+    printf("%zu commands\n", fake_sway_commands());
+    clean_fake_sway();
+  }
+  return 0;
+}
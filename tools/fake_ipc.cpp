@@ -0,0 +1,351 @@
+#include "fake_ipc.hpp"
+#include "log.hpp"
+#include "sway.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unordered_set>
+#include <unistd.h>
+#include <vector>
+
+#define FAKE_REQUEST_SIZE 8192
+
+int listen_unix(const std::string &path) {
+  struct sockaddr_un address;
+  if (path.size() >= sizeof(address.sun_path))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size());
+
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      listen(fd, 16) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool send_all(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t length =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (length < 0 && errno == EINTR)
+      continue;
+    if (length <= 0)
+      return false;
+    sent += length;
+  }
+  return true;
+}
+
+bool make_dirs(const std::string &path) {
+  for (size_t pos = 1; pos != std::string::npos;) {
+    pos = path.find('/', pos + 1);
+    std::string dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST)
+      return false;
+  }
+  return true;
+}
+
+// Hyprland
+
+int hyprland_control_fd = -1;
+int hyprland_events_fd = -1;
+int hyprland_stop_fd = -1;
+std::thread hyprland_thread;
+std::string hyprland_dir;
+
+std::mutex fake_hyprland_mutex;
+std::string hyprland_clients_reply;
+std::vector<int> hyprland_readers;
+std::atomic<size_t> hyprland_dispatches{0};
+
+// Like Hyprland, one request per connection, closed after the reply.
+void fake_hyprland_request(int fd) {
+  char request[FAKE_REQUEST_SIZE];
+  ssize_t length = read(fd, request, sizeof(request));
+  if (length <= 0)
+    return;
+
+  std::string command(request, length);
+  std::string reply;
+  if (command == "j/clients") {
+    std::lock_guard<std::mutex> lock(fake_hyprland_mutex);
+    reply = hyprland_clients_reply;
+  } else if (command.compare(0, 9, "dispatch ") == 0) {
+    hyprland_dispatches++;
+    reply = "ok";
+  } else {
+    reply = "unknown request";
+  }
+  send_all(fd, reply);
+}
+
+void fake_hyprland_loop() {
+  struct pollfd fds[3] = {{hyprland_stop_fd, POLLIN, 0},
+                          {hyprland_control_fd, POLLIN, 0},
+                          {hyprland_events_fd, POLLIN, 0}};
+
+  while (true) {
+    if (poll(fds, 3, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[0].revents & POLLIN)
+      return;
+
+    if (fds[1].revents & POLLIN) {
+      int fd = accept4(hyprland_control_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        fake_hyprland_request(fd);
+        close(fd);
+      }
+    }
+
+    if (fds[2].revents & POLLIN) {
+      int fd = accept4(hyprland_events_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        std::lock_guard<std::mutex> lock(fake_hyprland_mutex);
+        hyprland_readers.push_back(fd);
+      }
+    }
+  }
+}
+
+bool init_fake_hyprland(const std::string &runtime_dir,
+                        const std::string &signature,
+                        const std::string &clients) {
+  hyprland_dir = runtime_dir + "/hypr/" + signature;
+  if (!make_dirs(hyprland_dir)) {
+    error("Failed to create " + hyprland_dir);
+    return false;
+  }
+
+  set_fake_hyprland_clients(clients);
+  hyprland_control_fd = listen_unix(hyprland_dir + "/.socket.sock");
+  hyprland_events_fd = listen_unix(hyprland_dir + "/.socket2.sock");
+  hyprland_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (hyprland_control_fd < 0 || hyprland_events_fd < 0 ||
+      hyprland_stop_fd < 0) {
+    error("Failed to serve fake Hyprland sockets in " + hyprland_dir + ": " +
+          strerror(errno));
+    clean_fake_hyprland();
+    return false;
+  }
+
+  setenv("XDG_RUNTIME_DIR", runtime_dir.c_str(), 1);
+  setenv("HYPRLAND_INSTANCE_SIGNATURE", signature.c_str(), 1);
+  hyprland_thread = std::thread(fake_hyprland_loop);
+  return true;
+}
+
+void clean_fake_hyprland() {
+  if (hyprland_thread.joinable()) {
+    uint64_t value = 1;
+    if (write(hyprland_stop_fd, &value, sizeof(value)) == sizeof(value))
+      hyprland_thread.join();
+    else
+      hyprland_thread.detach();
+  }
+
+  for (int *fd : {&hyprland_control_fd, &hyprland_events_fd,
+                  &hyprland_stop_fd}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(fake_hyprland_mutex);
+  for (int fd : hyprland_readers) {
+    close(fd);
+  }
+  hyprland_readers.clear();
+
+  if (!hyprland_dir.empty()) {
+    unlink((hyprland_dir + "/.socket.sock").c_str());
+    unlink((hyprland_dir + "/.socket2.sock").c_str());
+  }
+}
+
+void set_fake_hyprland_clients(const std::string &clients) {
+  std::lock_guard<std::mutex> lock(fake_hyprland_mutex);
+  hyprland_clients_reply = clients;
+}
+
+void fake_hyprland_event(const std::string &line) {
+  std::lock_guard<std::mutex> lock(fake_hyprland_mutex);
+  for (auto it = hyprland_readers.begin(); it != hyprland_readers.end();) {
+    if (send_all(*it, line + "\n")) {
+      ++it;
+      continue;
+    }
+    close(*it);
+    it = hyprland_readers.erase(it);
+  }
+}
+
+size_t fake_hyprland_dispatches() {
+  return hyprland_dispatches;
+}
+
+// Sway
+
+int sway_listen_fd = -1;
+int sway_stop_fd = -1;
+std::thread sway_thread;
+std::string sway_path;
+
+std::mutex fake_sway_mutex;
+std::string sway_tree_reply;
+std::vector<int> sway_clients;
+std::unordered_set<int> sway_subscribers;
+std::atomic<size_t> sway_commands{0};
+
+void close_sway_client(int fd) {
+  std::lock_guard<std::mutex> lock(fake_sway_mutex);
+  sway_subscribers.erase(fd);
+  for (auto it = sway_clients.begin(); it != sway_clients.end(); ++it) {
+    if (*it == fd) {
+      sway_clients.erase(it);
+      break;
+    }
+  }
+  close(fd);
+}
+
+// Answers one message, returns false once the client is gone.
+bool fake_sway_message(int fd) {
+  uint32_t type;
+  std::string payload;
+  if (!sway_receive(fd, type, payload))
+    return false;
+
+  std::lock_guard<std::mutex> lock(fake_sway_mutex);
+  switch (type) {
+  case SWAY_RUN_COMMAND:
+    sway_commands++;
+    return sway_send(fd, type, "[{\"success\":true}]");
+  case SWAY_SUBSCRIBE:
+    sway_subscribers.insert(fd);
+    return sway_send(fd, type, "{\"success\":true}");
+  case SWAY_GET_TREE:
+    return sway_send(fd, type, sway_tree_reply);
+  default:
+    return sway_send(fd, type, "[]");
+  }
+}
+
+void fake_sway_loop() {
+  while (true) {
+    std::vector<struct pollfd> fds = {{sway_stop_fd, POLLIN, 0},
+                                      {sway_listen_fd, POLLIN, 0}};
+    {
+      std::lock_guard<std::mutex> lock(fake_sway_mutex);
+      for (int fd : sway_clients) {
+        fds.push_back({fd, POLLIN, 0});
+      }
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[0].revents & POLLIN)
+      return;
+
+    for (size_t i = 2; i < fds.size(); i++) {
+      if (fds[i].revents && !fake_sway_message(fds[i].fd))
+        close_sway_client(fds[i].fd);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      int fd = accept4(sway_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        std::lock_guard<std::mutex> lock(fake_sway_mutex);
+        sway_clients.push_back(fd);
+      }
+    }
+  }
+}
+
+bool init_fake_sway(const std::string &socket_path, const std::string &tree) {
+  sway_path = socket_path;
+  set_fake_sway_tree(tree);
+  sway_listen_fd = listen_unix(sway_path);
+  sway_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (sway_listen_fd < 0 || sway_stop_fd < 0) {
+    error("Failed to serve fake sway socket " + sway_path + ": " +
+          strerror(errno));
+    clean_fake_sway();
+    return false;
+  }
+
+  setenv("SWAYSOCK", sway_path.c_str(), 1);
+  sway_thread = std::thread(fake_sway_loop);
+  return true;
+}
+
+void clean_fake_sway() {
+  if (sway_thread.joinable()) {
+    uint64_t value = 1;
+    if (write(sway_stop_fd, &value, sizeof(value)) == sizeof(value))
+      sway_thread.join();
+    else
+      sway_thread.detach();
+  }
+
+  for (int *fd : {&sway_listen_fd, &sway_stop_fd}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(fake_sway_mutex);
+  for (int fd : sway_clients) {
+    close(fd);
+  }
+  sway_clients.clear();
+  sway_subscribers.clear();
+
+  if (!sway_path.empty())
+    unlink(sway_path.c_str());
+}
+
+void set_fake_sway_tree(const std::string &tree) {
+  std::lock_guard<std::mutex> lock(fake_sway_mutex);
+  sway_tree_reply = tree;
+}
+
+void fake_sway_event(uint32_t type, const std::string &payload) {
+  std::lock_guard<std::mutex> lock(fake_sway_mutex);
+  for (int fd : sway_subscribers) {
+    sway_send(fd, type, payload);
+  }
+}
+
+size_t fake_sway_commands() {
+  return sway_commands;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// In-process stand-ins for the compositor sockets. They answer like the
+// real ones with canned replies, so the IPC clients can be exercised and
+// timed without a running session.
+
+// Serves .socket.sock and .socket2.sock under <runtime_dir>/hypr/<signature>/
+// and points XDG_RUNTIME_DIR and HYPRLAND_INSTANCE_SIGNATURE at them.
+// j/clients is answered with clients, a JSON array as hyprctl prints it.
+bool init_fake_hyprland(const std::string &runtime_dir,
+                        const std::string &signature,
+                        const std::string &clients);
+void clean_fake_hyprland();
+void set_fake_hyprland_clients(const std::string &clients);
+// Sends an event line such as "openwindow>>55c3,1,foot,~" to every
+// connected .socket2.sock reader.
+void fake_hyprland_event(const std::string &line);
+size_t fake_hyprland_dispatches();
+
+// Serves the i3-ipc protocol on socket_path and points SWAYSOCK at it.
+// RUN_COMMAND always succeeds, GET_TREE is answered with tree and
+// SUBSCRIBE makes the connection receive fake_sway_event messages.
+bool init_fake_sway(const std::string &socket_path, const std::string &tree);
+void clean_fake_sway();
+void set_fake_sway_tree(const std::string &tree);
+// Sends an event, e.g. 0x80000003 with a window event payload, to every
+// subscribed connection.
+void fake_sway_event(uint32_t type, const std::string &payload);
+size_t fake_sway_commands();
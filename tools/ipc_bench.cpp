@@ -0,0 +1,181 @@
+// Compares compositor requests over the IPC sockets with spawning a helper
+// per request, as app_switch used to. Runs against the fake servers, so
+// it needs no session:
+//
+//   ipc_bench [iterations]
+
+#include "fake_ipc.hpp"
+#include "hyprland.hpp"
+#include "process.hpp"
+#include "sway.hpp"
+#include "windows.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define DEFAULT_ITERATIONS 1000
+// Spawns are much slower, fewer of them give the same confidence.
+#define SPAWN_DIVISOR 10
+#define SYNC_TIMEOUT_MS 1000
+
+const char *FAKE_CLIENTS = R"([
+  {"address": "0x55c3a0", "class": "firefox", "title": "Mozilla Firefox",
+   "focusHistoryID": 1},
+  {"address": "0x55c3b0", "class": "foot", "title": "~", "focusHistoryID": 0}
+])";
+
+std::string find_in_path(const std::string &name) {
+  const char *path = getenv("PATH");
+  if (!path)
+    return "";
+
+  std::string dirs = path;
+  for (size_t start = 0; start <= dirs.size();) {
+    size_t end = dirs.find(':', start);
+    if (end == std::string::npos)
+      end = dirs.size();
+    std::string file = dirs.substr(start, end - start) + "/" + name;
+    if (access(file.c_str(), X_OK) == 0)
+      return file;
+    start = end + 1;
+  }
+  return "";
+}
+
+// Prints the median and 99th percentile of one request in microseconds.
+void bench(const std::string &name, int iterations,
+           const std::function<bool()> &request) {
+  std::vector<double> samples;
+  int failures = 0;
+
+  for (int i = 0; i < iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    if (!request())
+      failures++;
+    samples.push_back(std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+  }
+
+  std::sort(samples.begin(), samples.end());
+  printf("%-36s median %9.1f us  p99 %9.1f us  (%d runs, %d failed)\n",
+         name.c_str(), samples[samples.size() / 2],
+         samples[samples.size() * 99 / 100], iterations, failures);
+}
+
+void bench_hyprland(int iterations) {
+  bench("hyprland socket: clients+dispatch", iterations, [] {
+    std::vector<HyprlandWindow> clients = hyprland_clients();
+    return !clients.empty() &&
+           hyprland_dispatch("focuswindow address:" + clients[0].address);
+  });
+
+  int spawns = std::max(1, iterations / SPAWN_DIVISOR);
+  if (!find_in_path("hyprctl").empty()) {
+    bench("hyprctl: clients+dispatch", spawns, [] {
+      return run_process({"hyprctl", "-j", "clients"}) &&
+             run_process({"hyprctl", "dispatch", "focuswindow",
+                          "address:0x55c3a0"});
+    });
+  } else {
+    // Without hyprctl, two spawns of true are a lower bound for it.
+    bench("spawn true x2 (hyprctl lower bound)", spawns, [] {
+      return run_process({"true"}) && run_process({"true"});
+    });
+  }
+}
+
+// Times the window registry fed by .socket2.sock events: how long an
+// event takes to reach a waiter, and a switch that needs no query.
+void bench_registry(int iterations) {
+  init_windows();
+  for (int i = 0; i < SYNC_TIMEOUT_MS && window_backend() == WINDOWS_NONE;
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (window_backend() == WINDOWS_NONE) {
+    fprintf(stderr, "The window registry did not sync\n");
+    clean_windows();
+    return;
+  }
+
+  int serial = 0;
+  bench("registry: event to waiter", iterations, [&serial] {
+    std::string address = "b" + std::to_string(++serial);
+    uint64_t since = window_events();
+    fake_hyprland_event("openwindow>>" + address + ",1,bench,Bench");
+    bool seen = wait_for_window("bench", "", since, SYNC_TIMEOUT_MS);
+    fake_hyprland_event("closewindow>>" + address);
+    return seen;
+  });
+
+  bench("registry: lookup+dispatch", iterations, [] {
+    AppWindow window;
+    return find_window("firefox", window) && focus_window(window);
+  });
+
+  clean_windows();
+}
+
+void bench_sway(int iterations, const std::string &socket_path) {
+  bench("sway socket: focus command", iterations,
+        [] { return sway_command("[app_id=\"firefox\"] focus"); });
+
+  int spawns = std::max(1, iterations / SPAWN_DIVISOR);
+  if (!find_in_path("swaymsg").empty()) {
+    bench("swaymsg: focus command", spawns, [&socket_path] {
+      return run_process(
+          {"swaymsg", "-s", socket_path, "[app_id=\"firefox\"] focus"});
+    });
+  } else {
+    // Without swaymsg, one spawn of true is a lower bound for it.
+    bench("spawn true (swaymsg lower bound)", spawns,
+          [] { return run_process({"true"}); });
+  }
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+  if (iterations <= 0) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  char runtime_dir[] = "/tmp/macrodeck-bench-XXXXXX";
+  if (!mkdtemp(runtime_dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  if (!init_processes())
+    return 1;
+
+  if (init_fake_hyprland(runtime_dir, "bench", FAKE_CLIENTS)) {
+    bench_hyprland(iterations);
+    bench_registry(iterations);
+    printf("fake Hyprland saw %zu dispatches\n", fake_hyprland_dispatches());
+    clean_fake_hyprland();
+  }
+
+  std::string sway_path = std::string(runtime_dir) + "/sway-ipc.sock";
+  if (init_fake_sway(sway_path, "{}")) {
+    bench_sway(iterations, sway_path);
+    printf("fake sway saw %zu commands\n", fake_sway_commands());
+    clean_sway();
+    clean_fake_sway();
+  }
+
+  clean_processes();
+  std::string hypr = std::string(runtime_dir) + "/hypr";
+  rmdir((hypr + "/bench").c_str());
+  rmdir(hypr.c_str());
+  rmdir(runtime_dir);
+  return 0;
+}
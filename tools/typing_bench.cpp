@@ -0,0 +1,195 @@
+// Finds the highest key_type rate at which every character arrives. The
+// virtual keyboard is read back through its own evdev node, grabbed so the
+// text does not reach the focused window. Needs access to /dev/uinput:
+//
+//   sudo typing_bench [characters]
+
+#include "keyboard.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define DEFAULT_CHARACTERS 500
+// How long the reader waits for stragglers after key_type returned.
+#define SETTLE_MS 200
+
+const char *SAMPLE_TEXT = "The quick brown fox jumps over the lazy dog, "
+                          "PACK MY BOX WITH FIVE DOZEN LIQUOR JUGS! "
+                          "0123456789 (a+b)*c = {x; y} <tag/> ~`|\\ ";
+
+// Characters per second, 0 is the burst mode of "rate": "max".
+const int RATES[] = {50, 100, 200, 500, 1000, 2000, 5000, 10000, 0};
+
+struct Result {
+  size_t expected;
+  size_t received;
+  size_t mismatches;
+  bool dropped;
+};
+
+int open_keyboard_node() {
+  DIR *dir = opendir("/dev/input");
+  if (!dir)
+    return -1;
+
+  int found = -1;
+  while (struct dirent *entry = readdir(dir)) {
+    if (strncmp(entry->d_name, "event", 5) != 0)
+      continue;
+
+    std::string path = std::string("/dev/input/") + entry->d_name;
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+      continue;
+
+    char name[256] = {};
+    if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0 &&
+        strcmp(name, "MacroDeck Keyboard") == 0) {
+      found = fd;
+      break;
+    }
+    close(fd);
+  }
+
+  closedir(dir);
+  return found;
+}
+
+// Every key event the text should produce, without the SYN frames.
+std::vector<struct input_event>
+expected_events(const std::vector<KeyCombo> &text) {
+  std::vector<struct input_event> events;
+  for (const KeyCombo &key : text) {
+    for (const auto *frames : {&key.press, &key.release}) {
+      for (const struct input_event &event : *frames) {
+        if (event.type == EV_KEY)
+          events.push_back(event);
+      }
+    }
+  }
+  return events;
+}
+
+void drain(int fd) {
+  struct input_event events[64];
+  while (read(fd, events, sizeof(events)) > 0) {
+  }
+}
+
+Result type_and_check(int fd, const std::vector<KeyCombo> &text,
+                      const TypingRate &rate, double &elapsed_ms) {
+  std::vector<struct input_event> expected = expected_events(text);
+  Result result{expected.size(), 0, 0, false};
+  std::atomic<bool> typed{false};
+
+  std::thread reader([&] {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (result.received < expected.size()) {
+      if (poll(&pfd, 1, typed ? SETTLE_MS : 1000) <= 0) {
+        if (typed)
+          return;
+        continue;
+      }
+
+      struct input_event events[64];
+      ssize_t length = read(fd, events, sizeof(events));
+      size_t count = length > 0 ? length / sizeof(events[0]) : 0;
+      for (size_t i = 0; i < count; i++) {
+        const struct input_event &event = events[i];
+        if (event.type == EV_SYN && event.code == SYN_DROPPED)
+          result.dropped = true;
+        if (event.type != EV_KEY || result.received >= expected.size())
+          continue;
+
+        const struct input_event &want = expected[result.received++];
+        if (event.code != want.code || event.value != want.value)
+          result.mismatches++;
+      }
+    }
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  key_type(text, rate);
+  elapsed_ms = std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+  typed = true;
+  reader.join();
+  return result;
+}
+
+int main(int argc, char **argv) {
+  size_t characters = argc > 1 ? atoi(argv[1]) : DEFAULT_CHARACTERS;
+  if (characters == 0) {
+    fprintf(stderr, "usage: %s [characters]\n", argv[0]);
+    return 1;
+  }
+
+  std::string sample;
+  while (sample.size() < characters) {
+    sample += SAMPLE_TEXT;
+  }
+  sample.resize(characters);
+
+  std::vector<KeyCombo> text;
+  if (!compile_text(sample, text))
+    return 1;
+
+  init_keyboard();
+  int fd = open_keyboard_node();
+  if (fd < 0) {
+    fprintf(stderr, "The MacroDeck Keyboard evdev node was not found\n");
+    clean_keyboard();
+    return 1;
+  }
+  if (ioctl(fd, EVIOCGRAB, 1) < 0)
+    perror("EVIOCGRAB, typed text may reach the focused window");
+
+  int best = -1;
+  for (int chars_per_second : RATES) {
+    drain(fd);
+
+    double elapsed_ms;
+    Result result =
+        type_and_check(fd, text, typing_rate(chars_per_second), elapsed_ms);
+    bool complete = !result.dropped && result.mismatches == 0 &&
+                    result.received == result.expected;
+
+    std::string name = chars_per_second > 0
+                           ? std::to_string(chars_per_second) + "/s"
+                           : std::string("max");
+    printf("%-8s %zu chars in %8.1f ms = %8.0f chars/s, %zu/%zu events, "
+           "%zu wrong%s\n",
+           name.c_str(), characters, elapsed_ms,
+           characters * 1000.0 / elapsed_ms, result.received,
+           result.expected, result.mismatches,
+           result.dropped ? ", SYN_DROPPED" : "");
+
+    if (!complete)
+      break;
+    best = chars_per_second;
+  }
+
+  if (best < 0) {
+    printf("No rate delivered every character\n");
+  } else {
+    printf("Highest complete rate: %s\n",
+           best > 0 ? (std::to_string(best) + "/s").c_str() : "max");
+  }
+
+  ioctl(fd, EVIOCGRAB, 0);
+  close(fd);
+  clean_keyboard();
+  return best < 0 ? 1 : 0;
+}